@@ -0,0 +1,209 @@
+// BatchPipeline.cpp : Read, code and write stages connected by bounded queues.
+//
+
+#include "stdafx.h"
+#include "BatchPipeline.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+
+typedef struct {
+	size_t index;
+	Mat_<Vec3b> image;
+	vector<uint8_t> bytes;
+}pipelineItem;
+
+pipelineOptions defaultPipelineOptions() {
+	pipelineOptions options;
+
+	options.quality = DEFAULT_QUALITY;
+	options.subsampling = false;
+	options.blockSize = DEFAULT_BLOCK_SIZE;
+	options.decompress = false;
+	options.readThreads = 2;
+	options.codecThreads = maxInt((int)thread::hardware_concurrency(), 1);
+	options.writeThreads = 2;
+	options.queueCapacity = 8;
+	options.cacheBytes = 0;
+
+	return options;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void readStage(const vector<string>& inputs, vector<pipelineResult>& results, atomic<size_t>& next, pipelineOptions* options, BoundedQueue<pipelineItem*>& out) {
+	for (size_t i = next++; i < inputs.size(); i = next++) {
+		pipelineItem* item = new pipelineItem;
+		item->index = i;
+
+		pipelineResult& result = results[i];
+		auto start = chrono::steady_clock::now();
+
+		if (options->decompress) {
+			if (!readFileBytes(inputs[i].c_str(), item->bytes)) {
+				result.error = "cannot read the file";
+			}
+		}
+		else {
+			item->image = imread(inputs[i], IMREAD_COLOR);
+
+			if (item->image.empty()) {
+				result.error = "cannot read the image";
+			}
+		}
+
+		result.readSeconds = secondsSince(start);
+
+		out.push(item);
+	}
+}
+
+void codecStage(vector<pipelineResult>& results, pipelineOptions* options, BoundedQueue<pipelineItem*>& in, BoundedQueue<pipelineItem*>& out,
+	pipelineCacheStatistics* cacheStatistics, mutex& cacheStatisticsLock) {
+	Encoder encoder(options->quality);
+	Decoder decoder;
+	blockCache cache = createBlockCache(options->cacheBytes);
+
+	encoder.setSubsampling(options->subsampling);
+	encoder.setBlockSize(options->blockSize);
+
+	if (options->cacheBytes > 0) {
+		encoder.setCache(&cache);
+	}
+
+	pipelineItem* item;
+
+	while (in.pop(item)) {
+		pipelineResult& result = results[item->index];
+
+		if (result.error.empty()) {
+			auto start = chrono::steady_clock::now();
+
+			if (options->decompress) {
+				if (!decoder.decodeContainer(item->bytes.data(), item->bytes.size(), item->image)) {
+					result.error = item->image.empty() ? "not a compressed image" : "truncated stream";
+				}
+
+				result.compressedBytes = item->bytes.size();
+				item->bytes.clear();
+				item->bytes.shrink_to_fit();
+			}
+			else {
+				encoder.encodeContainer(item->image, item->bytes);
+				result.compressedBytes = item->bytes.size();
+			}
+
+			result.codecSeconds = secondsSince(start);
+
+			result.width = item->image.cols;
+			result.height = item->image.rows;
+			result.rawBytes = (size_t)item->image.rows * item->image.cols * 3;
+
+			if (!options->decompress) {
+				item->image.release();
+			}
+		}
+
+		out.push(item);
+	}
+
+	if (cacheStatistics != NULL) {
+		lock_guard<mutex> lock(cacheStatisticsLock);
+
+		cacheStatistics->hits += cache.hits;
+		cacheStatistics->misses += cache.misses;
+		cacheStatistics->evictions += cache.evictions;
+	}
+}
+
+void writeStage(vector<pipelineResult>& results, pipelineOptions* options, BoundedQueue<pipelineItem*>& in) {
+	pipelineItem* item;
+
+	while (in.pop(item)) {
+		pipelineResult& result = results[item->index];
+
+		// a decompressed image of a truncated stream is still written, with its missing blocks black
+		bool writable = options->decompress ? !item->image.empty() : result.error.empty();
+
+		if (writable) {
+			auto start = chrono::steady_clock::now();
+
+			bool written = options->decompress ? imwrite(result.output, item->image) : writeFileBytes(result.output.c_str(), item->bytes.data(), item->bytes.size());
+
+			result.writeSeconds = secondsSince(start);
+
+			if (!written) {
+				result.error = "cannot write the output";
+			}
+		}
+
+		result.ok = result.error.empty();
+
+		delete item;
+	}
+}
+
+vector<pipelineResult> runPipeline(const vector<string>& inputs, const vector<string>& outputs, pipelineOptions* options, pipelineCacheStatistics* cacheStatistics) {
+	vector<pipelineResult> results(inputs.size());
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		results[i].input = inputs[i];
+		results[i].output = outputs[i];
+		results[i].width = results[i].height = 0;
+		results[i].rawBytes = results[i].compressedBytes = 0;
+		results[i].readSeconds = results[i].codecSeconds = results[i].writeSeconds = 0;
+		results[i].ok = false;
+	}
+
+	BoundedQueue<pipelineItem*> read(options->queueCapacity);
+	BoundedQueue<pipelineItem*> coded(options->queueCapacity);
+
+	atomic<size_t> next(0);
+	atomic<int> readersLeft(maxInt(options->readThreads, 1));
+	atomic<int> codersLeft(maxInt(options->codecThreads, 1));
+	mutex cacheStatisticsLock;
+
+	if (cacheStatistics != NULL) {
+		cacheStatistics->hits = cacheStatistics->misses = cacheStatistics->evictions = 0;
+	}
+
+	vector<thread> threads;
+
+	// the last thread to leave a stage closes the queue behind it
+	for (int t = 0; t < maxInt(options->readThreads, 1); t++) {
+		threads.push_back(thread([&]() {
+			readStage(inputs, results, next, options, read);
+
+			if (--readersLeft == 0) {
+				read.close();
+			}
+		}));
+	}
+
+	for (int t = 0; t < maxInt(options->codecThreads, 1); t++) {
+		threads.push_back(thread([&]() {
+			codecStage(results, options, read, coded, cacheStatistics, cacheStatisticsLock);
+
+			if (--codersLeft == 0) {
+				coded.close();
+			}
+		}));
+	}
+
+	for (int t = 0; t < maxInt(options->writeThreads, 1); t++) {
+		threads.push_back(thread([&]() {
+			writeStage(results, options, coded);
+		}));
+	}
+
+	for (thread& t : threads) {
+		t.join();
+	}
+
+	return results;
+}
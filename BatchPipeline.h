@@ -0,0 +1,111 @@
+// BatchPipeline.h : Batch engine that overlaps reading, coding and writing of files in separate stages.
+//
+
+#pragma once
+
+#include "JpegCodec.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Blocks the producer while full and the consumer while empty; once closed, pop drains what is left
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) {
+		this->capacity = capacity > 0 ? capacity : 1;
+		this->closed = false;
+	}
+
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+
+		if (closed) {
+			return false;
+		}
+
+		items.push_back(item);
+		notEmpty.notify_one();
+
+		return true;
+	}
+
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+
+		if (items.empty()) {
+			return false;
+		}
+
+		item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+};
+
+typedef struct {
+	int quality;
+	bool subsampling;
+	// of the containers written; decompression takes it from each container
+	int blockSize;
+	bool decompress;
+	int readThreads;
+	int codecThreads;
+	int writeThreads;
+	// items waiting between two stages; with the items being worked on this caps the images in memory
+	size_t queueCapacity;
+	// bytes of the block cache each codec thread keeps for its own encoder, 0 codes without one.
+	// The cache is not thread-safe, so the threads never share one; only 8x8 blocks are cached.
+	size_t cacheBytes;
+}pipelineOptions;
+
+// Counters of the block caches of all codec threads, added up when the threads finish
+typedef struct {
+	long long hits;
+	long long misses;
+	long long evictions;
+}pipelineCacheStatistics;
+
+typedef struct {
+	std::string input;
+	std::string output;
+	int width;
+	int height;
+	size_t rawBytes;
+	size_t compressedBytes;
+	double readSeconds;
+	double codecSeconds;
+	double writeSeconds;
+	bool ok;
+	std::string error;
+}pipelineResult;
+
+pipelineOptions defaultPipelineOptions();
+
+// Compresses images into containers, or decompresses containers into images when options->decompress is set.
+// Results are in the order of the inputs whatever order the stages finish them in.
+std::vector<pipelineResult> runPipeline(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs, pipelineOptions* options,
+	pipelineCacheStatistics* cacheStatistics = NULL);
@@ -0,0 +1,368 @@
+// BlockPipeline.h : The block pipeline as templates on the block size, with its tables computed at compile time.
+//
+
+#pragma once
+
+#include "JpegCodec.h"
+#include "Instrumentation.h"
+#include <math.h>
+
+// The stages work on plain arrays of N * N values in row-major order. With N a constant every loop has a
+// fixed trip count, which lets the compiler unroll and vectorize each size; the cv::Mat_ functions of the
+// 8x8 pipeline are wrappers around the N = 8 instances.
+
+// *************************************************************************************************
+//							Tables
+// *************************************************************************************************
+
+constexpr double BLOCK_PI = 3.14159265358979323846;
+
+constexpr double constexprCos(double x) {
+	while (x > BLOCK_PI) {
+		x -= 2 * BLOCK_PI;
+	}
+
+	while (x < -BLOCK_PI) {
+		x += 2 * BLOCK_PI;
+	}
+
+	// the Taylor series converges to double precision well within these terms on [-pi, pi]
+	double term = 1.0;
+	double sum = 1.0;
+
+	for (int k = 1; k < 30; k++) {
+		term *= -x * x / ((2 * k - 1) * (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+constexpr double constexprSqrt(double x) {
+	double root = x > 1.0 ? x : 1.0;
+
+	for (int i = 0; i < 64; i++) {
+		root = (root + x / root) / 2;
+	}
+
+	return root;
+}
+
+template <int N>
+struct blockTables {
+	// cosines[u][x] = c(u) cos((2x + 1) u pi / 2N), the orthonormal DCT basis ci() and cos() gave at run time
+	float cosines[N][N];
+	// row * N + col of the k-th coefficient in zigzag order
+	int zigZag[N * N];
+	// the table at quality 50
+	uchar quantization[N * N];
+};
+
+template <int N>
+constexpr blockTables<N> makeBlockTables() {
+	blockTables<N> tables = {};
+
+	for (int u = 0; u < N; u++) {
+		for (int x = 0; x < N; x++) {
+			double c = constexprSqrt((u == 0 ? 1.0 : 2.0) / N);
+			tables.cosines[u][x] = (float)(c * constexprCos((2 * x + 1) * u * BLOCK_PI / (2 * N)));
+		}
+	}
+
+	// odd anti-diagonals run down to the left, even ones up to the right, as zigZagTraversal walks them
+	int k = 0;
+
+	for (int diagonal = 0; diagonal < 2 * N - 1; diagonal++) {
+		for (int i = 0; i < N; i++) {
+			int row = diagonal % 2 == 1 ? i : diagonal - i;
+			int col = diagonal - row;
+
+			if (0 <= row && row < N && 0 <= col && col < N) {
+				tables.zigZag[k++] = row * N + col;
+			}
+		}
+	}
+
+	// Coefficient (u, v) of an NxN block has the frequency of (8u / N, 8v / N) in an 8x8 one. The DCT gain
+	// grows with N, so the steps are scaled by N / 8 to keep the quantized values in the range of one char.
+	for (int u = 0; u < N; u++) {
+		for (int v = 0; v < N; v++) {
+			int i = 8 * u / N < 7 ? 8 * u / N : 7;
+			int j = 8 * v / N < 7 ? 8 * v / N : 7;
+			int value = (quantizationValues[8 * i + j] * N + 4) / 8;
+
+			tables.quantization[u * N + v] = (uchar)(value < 1 ? 1 : value > 255 ? 255 : value);
+		}
+	}
+
+	return tables;
+}
+
+template <int N>
+const blockTables<N>& getBlockTables() {
+	static constexpr blockTables<N> tables = makeBlockTables<N>();
+
+	return tables;
+}
+
+constexpr int qualityScale(int quality) {
+	return quality < 50 ? 5000 / quality : 200 - 2 * quality;
+}
+
+// The DC of an NxN block spans -128N .. 127N. Past the quality returned here its step gets too small for
+// the quantized DC to fit in a char, and bright or dark blocks would saturate, so no quality goes above it.
+template <int N>
+constexpr int maxQualityOf() {
+	int base = makeBlockTables<N>().quantization[0];
+
+	for (int quality = 100; quality > 1; quality--) {
+		int step = (base * qualityScale(quality) + 50) / 100;
+
+		if (step > 0 && -128.0 * N / step > -128.5 && 127.0 * N / step < 127.5) {
+			return quality;
+		}
+	}
+
+	return 1;
+}
+
+// Scales the base table the same way as the IJG encoder, up to maxQualityOf<N>
+template <int N>
+void scaledQuantizationTable(int quality, uchar* q) {
+	const blockTables<N>& tables = getBlockTables<N>();
+	constexpr int highest = maxQualityOf<N>();
+
+	quality = minInt(maxInt(quality, 1), highest);
+
+	int scale = qualityScale(quality);
+
+	for (int k = 0; k < N * N; k++) {
+		int value = (tables.quantization[k] * scale + 50) / 100;
+		q[k] = (uchar)minInt(maxInt(value, 1), 255);
+	}
+}
+
+// *************************************************************************************************
+//							Compression
+// *************************************************************************************************
+
+// Samples outside the plane are 0, as in get8x8BlockAt
+template <int N>
+void getBlockSamples(const cv::Mat_<uchar>& plane, int x, int y, uchar* samples) {
+	PROFILE_SCOPE(ZONE_GET_BLOCK);
+
+	int rows = minInt(N, plane.rows - N * y);
+	int cols = minInt(N, plane.cols - N * x);
+
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			samples[N * i + j] = i < rows && j < cols ? plane(N * y + i, N * x + j) : 0;
+		}
+	}
+}
+
+// Rows first and then columns; the coefficients are rounded, as the 8x8 ones always were
+template <int N>
+void forwardDCT(const float* block, float* coefficients) {
+	PROFILE_SCOPE(ZONE_DCT);
+
+	const blockTables<N>& tables = getBlockTables<N>();
+
+	float rows[N * N];
+
+	for (int i = 0; i < N; i++) {
+		for (int v = 0; v < N; v++) {
+			float s = 0.0f;
+
+			for (int x = 0; x < N; x++) {
+				s += block[N * i + x] * tables.cosines[v][x];
+			}
+
+			rows[N * i + v] = s;
+		}
+	}
+
+	for (int u = 0; u < N; u++) {
+		for (int v = 0; v < N; v++) {
+			float s = 0.0f;
+
+			for (int y = 0; y < N; y++) {
+				s += rows[N * y + v] * tables.cosines[u][y];
+			}
+
+			coefficients[N * u + v] = roundf(s);
+		}
+	}
+}
+
+template <int N>
+void quantizeBlock(const float* coefficients, const uchar* q, char* quantized) {
+	PROFILE_SCOPE(ZONE_QUANTIZATION);
+
+	for (int k = 0; k < N * N; k++) {
+		int value = (int)roundf(coefficients[k] / q[k]);
+
+		quantized[k] = (char)(value < -128 ? -128 : value > 127 ? 127 : value);
+	}
+}
+
+template <int N>
+void zigZagScan(const char* quantized, char* vals) {
+	PROFILE_SCOPE(ZONE_ZIGZAG);
+
+	const blockTables<N>& tables = getBlockTables<N>();
+
+	for (int k = 0; k < N * N; k++) {
+		vals[k] = quantized[tables.zigZag[k]];
+	}
+}
+
+// Returns the number of elements written to code, EOB included; code needs room for N * N + 1 of them.
+// A run count is one byte, so runs longer than 255 (a 16x16 block of zeros) are split in two.
+template <int N>
+int runLengthEncode(const char* vals, rleElement* code) {
+	PROFILE_SCOPE(ZONE_RLE);
+
+	int len = 0;
+
+	code[0].val = vals[0];
+	code[0].count = 1;
+
+	for (int k = 1; k < N * N; k++) {
+		if (vals[k] == code[len].val && code[len].count < 255) {
+			code[len].count++;
+		}
+		else {
+			len++;
+			code[len].val = vals[k];
+			code[len].count = 1;
+		}
+	}
+
+	code[++len] = EOB;
+
+	return len + 1;
+}
+
+template <int N>
+int encodeBlockSamples(const uchar* samples, const uchar* q, rleElement* code) {
+	float block[N * N];
+	float coefficients[N * N];
+	char quantized[N * N];
+	char vals[N * N];
+
+	for (int k = 0; k < N * N; k++) {
+		block[k] = samples[k] - 128.0f;
+	}
+
+	forwardDCT<N>(block, coefficients);
+	quantizeBlock<N>(coefficients, q, quantized);
+	zigZagScan<N>(quantized, vals);
+
+	return runLengthEncode<N>(vals, code);
+}
+
+// *************************************************************************************************
+//							Decompression
+// *************************************************************************************************
+
+// code must end with EOB; values past N * N are dropped and missing ones are 0
+template <int N>
+void runLengthDecode(const rleElement* code, char* vals) {
+	PROFILE_SCOPE(ZONE_RLE_DECODE);
+
+	int n = 0;
+
+	for (int i = 0; !(code[i].val == EOB.val && code[i].count == EOB.count); i++) {
+		for (int cnt = code[i].count; cnt > 0 && n < N * N; cnt--) {
+			vals[n++] = code[i].val;
+		}
+	}
+
+	while (n < N * N) {
+		vals[n++] = 0;
+	}
+}
+
+template <int N>
+void zigZagUnscan(const char* vals, char* quantized) {
+	PROFILE_SCOPE(ZONE_ZIGZAG_RECONSTRUCTION);
+
+	const blockTables<N>& tables = getBlockTables<N>();
+
+	for (int k = 0; k < N * N; k++) {
+		quantized[tables.zigZag[k]] = vals[k];
+	}
+}
+
+template <int N>
+void dequantizeBlock(const char* quantized, const uchar* q, float* coefficients) {
+	PROFILE_SCOPE(ZONE_DEQUANTIZATION);
+
+	for (int k = 0; k < N * N; k++) {
+		coefficients[k] = (float)(quantized[k] * q[k]);
+	}
+}
+
+template <int N>
+void inverseDCT(const float* coefficients, float* block) {
+	PROFILE_SCOPE(ZONE_IDCT);
+
+	const blockTables<N>& tables = getBlockTables<N>();
+
+	float columns[N * N];
+
+	for (int y = 0; y < N; y++) {
+		for (int v = 0; v < N; v++) {
+			float s = 0.0f;
+
+			for (int u = 0; u < N; u++) {
+				s += coefficients[N * u + v] * tables.cosines[u][y];
+			}
+
+			columns[N * y + v] = s;
+		}
+	}
+
+	for (int y = 0; y < N; y++) {
+		for (int x = 0; x < N; x++) {
+			float s = 0.0f;
+
+			for (int v = 0; v < N; v++) {
+				s += columns[N * y + v] * tables.cosines[v][x];
+			}
+
+			block[N * y + x] = roundf(s);
+		}
+	}
+}
+
+// Back to the range of the samples; values the quantization pushed past it are clamped rather than wrapped
+inline uchar levelShiftSample(float value) {
+	int sample = (int)value + 128;
+
+	return (uchar)(sample < 0 ? 0 : sample > 255 ? 255 : sample);
+}
+
+template <int N>
+void decodeBlockValues(const char* vals, const uchar* q, uchar* samples) {
+	char quantized[N * N];
+	float coefficients[N * N];
+	float block[N * N];
+
+	zigZagUnscan<N>(vals, quantized);
+	dequantizeBlock<N>(quantized, q, coefficients);
+	inverseDCT<N>(coefficients, block);
+
+	for (int k = 0; k < N * N; k++) {
+		samples[k] = levelShiftSample(block[k]);
+	}
+}
+
+template <int N>
+void decodeBlockCode(const rleElement* code, const uchar* q, uchar* samples) {
+	char vals[N * N];
+
+	runLengthDecode<N>(code, vals);
+	decodeBlockValues<N>(vals, q, samples);
+}
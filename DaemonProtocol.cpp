@@ -0,0 +1,120 @@
+// DaemonProtocol.cpp : Socket and shared memory helpers used by both ends of the daemon protocol.
+//
+
+#include "stdafx.h"
+#include "DaemonProtocol.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool sendAll(int fd, const void* data, size_t size) {
+	const char* bytes = (const char*)data;
+
+	while (size > 0) {
+		// MSG_NOSIGNAL: a client that went away must not kill the daemon with SIGPIPE
+		ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (sent <= 0) {
+			return false;
+		}
+
+		bytes += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+bool receiveAll(int fd, void* data, size_t size) {
+	char* bytes = (char*)data;
+
+	while (size > 0) {
+		ssize_t received = recv(fd, bytes, size, 0);
+
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (received <= 0) {
+			return false;
+		}
+
+		bytes += received;
+		size -= received;
+	}
+
+	return true;
+}
+
+bool createSharedPayload(const char* prefix, uint32_t id, const uint8_t* data, size_t size, char* name) {
+	snprintf(name, SHARED_NAME_LENGTH, "/%s-%d-%u", prefix, (int)getpid(), id);
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	void* mapped = MAP_FAILED;
+
+	if (ftruncate(fd, size) == 0) {
+		mapped = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+		shm_unlink(name);
+		return false;
+	}
+
+	memcpy(mapped, data, size);
+	munmap(mapped, size);
+
+	return true;
+}
+
+const uint8_t* mapSharedPayload(const char* name, size_t size) {
+	char terminated[SHARED_NAME_LENGTH];
+
+	// the name comes from the peer, so it is not trusted to be terminated
+	memcpy(terminated, name, SHARED_NAME_LENGTH);
+	terminated[SHARED_NAME_LENGTH - 1] = 0;
+
+	int fd = shm_open(terminated, O_RDONLY, 0);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	shm_unlink(terminated);
+
+	struct stat status;
+	void* mapped = MAP_FAILED;
+
+	if (fstat(fd, &status) == 0 && (size_t)status.st_size >= size && size > 0) {
+		mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	return mapped == MAP_FAILED ? NULL : (const uint8_t*)mapped;
+}
+
+void unmapSharedPayload(const uint8_t* data, size_t size) {
+	munmap((void*)data, size);
+}
+
+#endif
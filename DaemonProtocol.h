@@ -0,0 +1,74 @@
+// DaemonProtocol.h : Messages exchanged between the compression daemon and its clients over a Unix domain socket.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define DAEMON_SOCKET "/tmp/jpegd.sock"
+#define DAEMON_MAGIC 0x4A504744
+#define SHARED_NAME_LENGTH 64
+// payloads above this size are handed over in shared memory instead of being copied through the socket
+#define DEFAULT_SHARED_THRESHOLD (256 * 1024)
+// larger inline payloads are refused, so a corrupt header cannot make the reader allocate gigabytes
+#define MAX_INLINE_PAYLOAD (64 * 1024 * 1024)
+
+enum daemonCommand {
+	// payload: width x height BGR pixels, answer: a container
+	COMMAND_COMPRESS = 1,
+	// payload: a container, answer: width x height BGR pixels
+	COMMAND_DECOMPRESS = 2,
+	// no payload, answer: the statistics as JSON text
+	COMMAND_STATS = 3
+};
+
+enum daemonStatus {
+	STATUS_OK = 0,
+	STATUS_INVALID_REQUEST = 1,
+	STATUS_INVALID_PAYLOAD = 2,
+	// the container was decoded, but its end was missing and those blocks are black
+	STATUS_TRUNCATED = 3,
+	STATUS_INTERNAL_ERROR = 4
+};
+
+// A message is its header followed by payloadSize bytes, unless sharedName is set: the payload is then
+// in the POSIX shared memory object of that name, which its reader unlinks once done with it
+typedef struct {
+	uint32_t magic;
+	// chosen by the client; answers come back in completion order, carrying the id of their request
+	uint32_t id;
+	int32_t command;
+	int32_t quality;
+	int32_t subsampling;
+	int32_t width;
+	int32_t height;
+	// answers bigger than this come back in shared memory, 0 keeps them in the socket
+	uint64_t sharedThreshold;
+	uint64_t payloadSize;
+	char sharedName[SHARED_NAME_LENGTH];
+}requestHeader;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t id;
+	int32_t status;
+	int32_t width;
+	int32_t height;
+	uint64_t payloadSize;
+	char sharedName[SHARED_NAME_LENGTH];
+}responseHeader;
+
+bool sendAll(int fd, const void* data, size_t size);
+
+// Returns false on error or if the peer closes the connection before size bytes arrive
+bool receiveAll(int fd, void* data, size_t size);
+
+// Creates a shared memory object named after prefix and id holding a copy of data, and writes its name to name
+bool createSharedPayload(const char* prefix, uint32_t id, const uint8_t* data, size_t size, char* name);
+
+// Maps a shared payload read-only and unlinks its name, so it disappears once unmapped; NULL on failure
+const uint8_t* mapSharedPayload(const char* name, size_t size);
+
+void unmapSharedPayload(const uint8_t* data, size_t size);
@@ -0,0 +1,219 @@
+// Instrumentation.cpp : Thread-local accumulation of the timers and counters, and their dumps.
+//
+
+#include "stdafx.h"
+#include "Instrumentation.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define MAX_TRACE_EVENTS (1 << 20)
+
+atomic<bool> instrumentationOn(false);
+static atomic<bool> tracingOn(false);
+
+static const char* zoneNames[ZONES] = {
+	"compressImage",
+	"decompressImage",
+	"readFile",
+	"writeFile",
+	"colorSpaceConversion",
+	"chromaticDownsampling",
+	"getBlock",
+	"discreteCosineTransform",
+	"quantization",
+	"zigZagTraversal",
+	"rle",
+	"rleDecode",
+	"zigZagReconstruction",
+	"dequantization",
+	"inverseDiscreteCosineTransform",
+	"storeBlock",
+	"inverseColorSpaceConversion"
+};
+
+static const char* counterNames[COUNTERS] = {
+	"blocks encoded",
+	"blocks decoded",
+	"bytes written Y",
+	"bytes written Cr",
+	"bytes written Cb",
+	"zero blocks",
+	"flat blocks",
+	"allocations"
+};
+
+typedef struct {
+	int zone;
+	long long start;
+	long long duration;
+}traceEvent;
+
+// Written only by its own thread, so recording takes no lock
+typedef struct {
+	int thread;
+	long long calls[ZONES];
+	long long nanoseconds[ZONES];
+	long long counters[COUNTERS];
+	vector<traceEvent> events;
+	long long droppedEvents;
+}threadProfile;
+
+// Profiles outlive their threads, so the dumps still see the work of the threads that have finished
+static mutex registryMutex;
+static vector<unique_ptr<threadProfile>> registry;
+static thread_local threadProfile* currentProfile = NULL;
+
+static const chrono::steady_clock::time_point clockOrigin = chrono::steady_clock::now();
+
+void clearProfile(threadProfile* profile) {
+	for (int z = 0; z < ZONES; z++) {
+		profile->calls[z] = profile->nanoseconds[z] = 0;
+	}
+
+	for (int c = 0; c < COUNTERS; c++) {
+		profile->counters[c] = 0;
+	}
+
+	profile->events.clear();
+	profile->droppedEvents = 0;
+}
+
+threadProfile* getThreadProfile() {
+	if (currentProfile == NULL) {
+		lock_guard<mutex> lock(registryMutex);
+
+		registry.push_back(unique_ptr<threadProfile>(new threadProfile));
+		currentProfile = registry.back().get();
+		currentProfile->thread = (int)registry.size();
+		clearProfile(currentProfile);
+	}
+
+	return currentProfile;
+}
+
+void setInstrumentation(bool on) {
+	instrumentationOn = on;
+}
+
+void setTracing(bool on) {
+	tracingOn = on;
+}
+
+void resetInstrumentation() {
+	lock_guard<mutex> lock(registryMutex);
+
+	for (unique_ptr<threadProfile>& profile : registry) {
+		clearProfile(profile.get());
+	}
+}
+
+long long profileClock() {
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - clockOrigin).count();
+}
+
+void recordZone(profileZone zone, long long start, long long end) {
+	threadProfile* profile = getThreadProfile();
+
+	profile->calls[zone]++;
+	profile->nanoseconds[zone] += end - start;
+
+	if (tracingOn.load(memory_order_relaxed)) {
+		if (profile->events.size() < MAX_TRACE_EVENTS) {
+			profile->events.push_back({ zone, start, end - start });
+		}
+		else {
+			profile->droppedEvents++;
+		}
+	}
+}
+
+void countEvent(profileCounter counter, long long n) {
+	getThreadProfile()->counters[counter] += n;
+}
+
+void printInstrumentationSummary(FILE* out) {
+#ifdef JPEG_NO_INSTRUMENTATION
+	fprintf(out, "Instrumentation was compiled out (JPEG_NO_INSTRUMENTATION)\n");
+#else
+	long long calls[ZONES] = {};
+	long long nanoseconds[ZONES] = {};
+	long long counters[COUNTERS] = {};
+	long long droppedEvents = 0;
+
+	lock_guard<mutex> lock(registryMutex);
+
+	for (unique_ptr<threadProfile>& profile : registry) {
+		for (int z = 0; z < ZONES; z++) {
+			calls[z] += profile->calls[z];
+			nanoseconds[z] += profile->nanoseconds[z];
+		}
+
+		for (int c = 0; c < COUNTERS; c++) {
+			counters[c] += profile->counters[c];
+		}
+
+		droppedEvents += profile->droppedEvents;
+	}
+
+	// zones nest (the block stages run inside compressImage), so the times are not meant to add up
+	fprintf(out, "%-32s %12s %14s %12s\n", "Zone", "Calls", "Total ms", "Mean ns");
+
+	for (int z = 0; z < ZONES; z++) {
+		if (calls[z] == 0) {
+			continue;
+		}
+
+		fprintf(out, "%-32s %12lld %14.3f %12.0f\n", zoneNames[z], calls[z], nanoseconds[z] / 1e6, (double)nanoseconds[z] / calls[z]);
+	}
+
+	fprintf(out, "\n%-32s %12s\n", "Counter", "Value");
+
+	for (int c = 0; c < COUNTERS; c++) {
+		fprintf(out, "%-32s %12lld\n", counterNames[c], counters[c]);
+	}
+
+	fprintf(out, "%-32s %12zu\n", "threads", registry.size());
+
+	if (droppedEvents > 0) {
+		fprintf(out, "%-32s %12lld\n", "trace events dropped", droppedEvents);
+	}
+#endif
+}
+
+bool writeChromeTrace(const char* filename) {
+	FILE* pf = fopen(filename, "w");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	lock_guard<mutex> lock(registryMutex);
+
+	// complete ("X") events in microseconds, one track per thread, as chrome://tracing and Perfetto read them
+	fprintf(pf, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	bool first = true;
+
+	for (unique_ptr<threadProfile>& profile : registry) {
+		fprintf(pf, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"codec thread %d\"}}",
+			first ? "" : ",\n", profile->thread, profile->thread);
+		first = false;
+
+		for (const traceEvent& e : profile->events) {
+			fprintf(pf, ",\n{\"name\":\"%s\",\"cat\":\"jpeg\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				zoneNames[e.zone], profile->thread, e.start / 1e3, e.duration / 1e3);
+		}
+	}
+
+	fprintf(pf, "\n]}\n");
+
+	bool written = !ferror(pf);
+
+	fclose(pf);
+
+	return written;
+}
@@ -0,0 +1,98 @@
+// Instrumentation.h : Scoped timers and counters on the hot path of the codec, with a summary table and a Chrome trace export.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+
+// Defining JPEG_NO_INSTRUMENTATION removes every timer and counter from the build; otherwise they stay
+// in and cost one relaxed load and a branch while switched off at run time (the default)
+
+enum profileZone {
+	ZONE_COMPRESS_IMAGE,
+	ZONE_DECOMPRESS_IMAGE,
+	ZONE_READ_FILE,
+	ZONE_WRITE_FILE,
+	ZONE_COLOR_CONVERSION,
+	ZONE_CHROMA_DOWNSAMPLING,
+	ZONE_GET_BLOCK,
+	ZONE_DCT,
+	ZONE_QUANTIZATION,
+	ZONE_ZIGZAG,
+	ZONE_RLE,
+	ZONE_RLE_DECODE,
+	ZONE_ZIGZAG_RECONSTRUCTION,
+	ZONE_DEQUANTIZATION,
+	ZONE_IDCT,
+	ZONE_STORE_BLOCK,
+	ZONE_INVERSE_COLOR_CONVERSION,
+	ZONES
+};
+
+enum profileCounter {
+	COUNTER_BLOCKS_ENCODED,
+	COUNTER_BLOCKS_DECODED,
+	// must stay in component order: Y, Cr, Cb
+	COUNTER_BYTES_Y,
+	COUNTER_BYTES_CR,
+	COUNTER_BYTES_CB,
+	// every quantized coefficient is zero
+	COUNTER_ZERO_BLOCKS,
+	// only the DC coefficient is not zero
+	COUNTER_FLAT_BLOCKS,
+	// buffers the codec callocs itself on the block path; cv::Mat buffers are not included
+	COUNTER_ALLOCATIONS,
+	COUNTERS
+};
+
+extern std::atomic<bool> instrumentationOn;
+
+void setInstrumentation(bool on);
+
+// Trace events are kept per thread as well, up to a limit per thread past which they are only counted
+void setTracing(bool on);
+
+// Clears what was recorded so far; not to be called while instrumented code runs
+void resetInstrumentation();
+
+long long profileClock();
+void recordZone(profileZone zone, long long start, long long end);
+void countEvent(profileCounter counter, long long n);
+
+// Both dumps read the data of every thread, so call them once the instrumented work has finished
+void printInstrumentationSummary(FILE* out);
+bool writeChromeTrace(const char* filename);
+
+class ScopedTimer {
+public:
+	ScopedTimer(profileZone zone) : active(instrumentationOn.load(std::memory_order_relaxed)), zone(zone), start(0) {
+		if (active) {
+			start = profileClock();
+		}
+	}
+
+	~ScopedTimer() {
+		if (active) {
+			recordZone(zone, start, profileClock());
+		}
+	}
+
+private:
+	bool active;
+	profileZone zone;
+	long long start;
+};
+
+#ifdef JPEG_NO_INSTRUMENTATION
+#define PROFILE_SCOPE(zone)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_ENABLED() false
+#else
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(zone) ScopedTimer PROFILE_JOIN(profileScope, __LINE__)(zone)
+#define PROFILE_COUNT(counter, n) do { if (instrumentationOn.load(std::memory_order_relaxed)) countEvent(counter, n); } while (0)
+#define PROFILE_ENABLED() instrumentationOn.load(std::memory_order_relaxed)
+#endif
@@ -0,0 +1,583 @@
+// JpegBatch.cpp : Command line tool that compresses or decompresses whole directories without any window.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "BatchPipeline.h"
+#include "TaskScheduler.h"
+#include "ShardedEncoder.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+
+using namespace cv;
+using namespace std;
+
+namespace fs = std::filesystem;
+
+#define COMPRESSED_EXTENSION ".jpc"
+
+typedef struct {
+	vector<string> inputs;
+	string outputDirectory;
+	bool json;
+	// encode the whole batch at once on the work-stealing scheduler instead of one file per codec thread
+	bool scheduled;
+	// encode each image with this many worker processes, 0 keeps everything in this process
+	int processes;
+	bool pinProcesses;
+	bool profile;
+	string traceFile;
+	string decompressedExtension;
+	pipelineOptions pipeline;
+}batchOptions;
+
+// *************************************************************************************************
+//							Command Line
+// *************************************************************************************************
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options] <file or directory>...\n", program);
+	printf("  -o <dir>        output directory (default: .)\n");
+	printf("  -q <1-100>      quality, at most %d, %d and %d with -k 4, 8 and 16 (default: %d)\n", maxQuality(4), maxQuality(8), maxQuality(16), DEFAULT_QUALITY);
+	printf("  -s <444|420>    420 blurs the chroma over 2x2 pixels, which is still coded at full size (default: 444)\n");
+	printf("  -k <4|8|16>     block size (default: %d)\n", DEFAULT_BLOCK_SIZE);
+	printf("  -j <n>          coding threads (default: number of cores)\n");
+	printf("  -r <n>          reading threads (default: 2)\n");
+	printf("  -w <n>          writing threads (default: 2)\n");
+	printf("  -b <n>          files queued between two stages (default: 8)\n");
+	printf("  -c <bytes>      block cache of each coding thread, repeated 8x8 blocks skip the transform (default: 0, none)\n");
+	printf("  -t              split images into block-column tasks on a work-stealing scheduler (compression only)\n");
+	printf("  -p <n>          encode each image with n worker processes (compression only)\n");
+	printf("  --pin           bind each worker process to its own processor\n");
+	printf("  -d              decompress %s files instead of compressing images\n", COMPRESSED_EXTENSION);
+	printf("  -e <ext>        extension of decompressed images (default: .bmp)\n");
+	printf("  --json          print the report as JSON\n");
+	printf("  --profile       print the time spent in each stage of the codec to stderr\n");
+	printf("  --trace <file>  write a Chrome trace_event JSON timeline of the codec threads\n");
+}
+
+bool parseArguments(int argc, char** argv, batchOptions* options) {
+	options->outputDirectory = ".";
+	options->pipeline = defaultPipelineOptions();
+	options->json = false;
+	options->scheduled = false;
+	options->processes = 0;
+	options->pinProcesses = false;
+	options->profile = false;
+	options->decompressedExtension = ".bmp";
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "-o" && hasValue) {
+			options->outputDirectory = argv[++i];
+		}
+		else if (arg == "-q" && hasValue) {
+			options->pipeline.quality = atoi(argv[++i]);
+		}
+		else if (arg == "-s" && hasValue) {
+			string mode = argv[++i];
+
+			if (mode != "444" && mode != "420") {
+				printf("Unknown subsampling %s\n", mode.c_str());
+				return false;
+			}
+
+			options->pipeline.subsampling = mode == "420";
+		}
+		else if (arg == "-k" && hasValue) {
+			options->pipeline.blockSize = atoi(argv[++i]);
+
+			if (!isSupportedBlockSize(options->pipeline.blockSize)) {
+				printf("Unsupported block size %s\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-j" && hasValue) {
+			options->pipeline.codecThreads = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-r" && hasValue) {
+			options->pipeline.readThreads = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-w" && hasValue) {
+			options->pipeline.writeThreads = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-b" && hasValue) {
+			options->pipeline.queueCapacity = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-c" && hasValue) {
+			long long bytes = atoll(argv[++i]);
+
+			if (bytes <= 0) {
+				printf("Invalid cache size %s\n", argv[i]);
+				return false;
+			}
+
+			options->pipeline.cacheBytes = (size_t)bytes;
+		}
+		else if (arg == "-e" && hasValue) {
+			options->decompressedExtension = argv[++i];
+
+			if (options->decompressedExtension[0] != '.') {
+				options->decompressedExtension = "." + options->decompressedExtension;
+			}
+		}
+		else if (arg == "-d") {
+			options->pipeline.decompress = true;
+		}
+		else if (arg == "-p" && hasValue) {
+			options->processes = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--pin") {
+			options->pinProcesses = true;
+		}
+		else if (arg == "-t") {
+			options->scheduled = true;
+		}
+		else if (arg == "--profile") {
+			options->profile = true;
+		}
+		else if (arg == "--trace" && hasValue) {
+			options->traceFile = argv[++i];
+		}
+		else if (arg == "--json") {
+			options->json = true;
+		}
+		else if (arg == "-h" || arg == "--help" || arg[0] == '-') {
+			return false;
+		}
+		else {
+			options->inputs.push_back(arg);
+		}
+	}
+
+	if ((options->scheduled || options->processes > 0) && options->pipeline.decompress) {
+		printf("-t and -p only apply to compression\n");
+		return false;
+	}
+
+	if (options->scheduled && options->processes > 0) {
+		printf("-t and -p cannot be combined\n");
+		return false;
+	}
+
+	if (options->pipeline.cacheBytes > 0 && (options->scheduled || options->processes > 0 || options->pipeline.decompress)) {
+		printf("-c only applies to compression without -t and -p\n");
+		return false;
+	}
+
+	if (options->pipeline.cacheBytes > 0 && options->pipeline.blockSize != 8) {
+		printf("-c only caches 8x8 blocks\n");
+		return false;
+	}
+
+	if ((options->scheduled || options->processes > 0) && options->pipeline.blockSize != DEFAULT_BLOCK_SIZE) {
+		printf("-t and -p only code %dx%d blocks\n", DEFAULT_BLOCK_SIZE, DEFAULT_BLOCK_SIZE);
+		return false;
+	}
+
+	// after the loop, as the highest quality depends on -k
+	options->pipeline.quality = checkQualityArgument(options->pipeline.quality, options->pipeline.blockSize);
+
+	return !options->inputs.empty();
+}
+
+bool isImageFile(const fs::path& path) {
+	string extension = path.extension().string();
+
+	for (char& c : extension) {
+		c = (char)tolower(c);
+	}
+
+	const char* extensions[] = { ".bmp", ".png", ".jpg", ".jpeg", ".ppm", ".pgm", ".tif", ".tiff" };
+
+	for (const char* e : extensions) {
+		if (extension == e) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Sorted by path; names holds the path of each file relative to the directory it was found in, or its
+// file name when it was given on its own
+void collectInputFiles(batchOptions* options, vector<string>& files, vector<string>& names) {
+	vector<pair<string, string>> found;
+
+	for (const string& input : options->inputs) {
+		error_code ec;
+
+		if (fs::is_directory(input, ec)) {
+			for (const fs::directory_entry& entry : fs::recursive_directory_iterator(input, ec)) {
+				if (!entry.is_regular_file()) {
+					continue;
+				}
+
+				bool wanted = options->pipeline.decompress ? entry.path().extension() == COMPRESSED_EXTENSION : isImageFile(entry.path());
+
+				if (wanted) {
+					found.push_back({ entry.path().string(), entry.path().lexically_relative(input).string() });
+				}
+			}
+		}
+		else {
+			found.push_back({ input, fs::path(input).filename().string() });
+		}
+	}
+
+	sort(found.begin(), found.end());
+
+	for (const pair<string, string>& f : found) {
+		files.push_back(f.first);
+		names.push_back(f.second);
+	}
+}
+
+// Mirrors the subdirectories of the inputs under the output directory and swaps the extension. Fails if
+// two inputs would still be written to the same file, as img.png and img.jpg would.
+bool outputFiles(const vector<string>& inputs, const vector<string>& names, batchOptions* options, vector<string>& outputs) {
+	string extension = options->pipeline.decompress ? options->decompressedExtension : COMPRESSED_EXTENSION;
+	map<string, string> writers;
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		fs::path output = fs::path(options->outputDirectory) / fs::path(names[i]).replace_extension(extension);
+		string key = output.lexically_normal().string();
+
+		if (writers.count(key) > 0) {
+			printf("%s and %s would both be written to %s\n", writers[key].c_str(), inputs[i].c_str(), output.string().c_str());
+			return false;
+		}
+
+		writers[key] = inputs[i];
+
+		error_code ec;
+		fs::create_directories(output.parent_path(), ec);
+
+		outputs.push_back(output.string());
+	}
+
+	return true;
+}
+
+// *************************************************************************************************
+//							Scheduled Batch
+// *************************************************************************************************
+
+// Loads every image, encodes them together with one task per block column and writes the containers.
+// Unlike the pipeline the whole batch is in memory at once, but one large image no longer keeps a single
+// thread busy while the others sit idle.
+vector<pipelineResult> runScheduledBatch(const vector<string>& inputs, const vector<string>& outputs, pipelineOptions* options, vector<workerStatistics>& statistics) {
+	vector<pipelineResult> results(inputs.size());
+	vector<Mat_<Vec3b>> images(inputs.size());
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		pipelineResult& r = results[i];
+
+		r.input = inputs[i];
+		r.output = outputs[i];
+		r.compressedBytes = 0;
+		r.codecSeconds = r.writeSeconds = 0;
+		r.ok = false;
+
+		auto start = chrono::steady_clock::now();
+		images[i] = imread(inputs[i], IMREAD_COLOR);
+		r.readSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		r.width = images[i].cols;
+		r.height = images[i].rows;
+		r.rawBytes = (size_t)r.width * r.height * 3;
+
+		if (images[i].empty()) {
+			r.error = "cannot read the image";
+		}
+	}
+
+	WorkStealingScheduler scheduler(options->codecThreads);
+
+	auto start = chrono::steady_clock::now();
+	vector<vector<uint8_t>> streams = encodeBatch(scheduler, images, options->quality, options->subsampling);
+	double codecSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	statistics = scheduler.getStatistics();
+
+	double totalPixels = 0;
+
+	for (const pipelineResult& r : results) {
+		totalPixels += (double)r.width * r.height;
+	}
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		pipelineResult& r = results[i];
+
+		if (!r.error.empty()) {
+			continue;
+		}
+
+		// the images are coded together, so each one is charged its share of the batch time by pixel count
+		r.codecSeconds = codecSeconds * r.width * r.height / totalPixels;
+		r.compressedBytes = streams[i].size();
+
+		auto written = chrono::steady_clock::now();
+
+		if (!writeFileBytes(r.output.c_str(), streams[i].data(), streams[i].size())) {
+			r.error = "cannot write the output";
+		}
+
+		r.writeSeconds = chrono::duration<double>(chrono::steady_clock::now() - written).count();
+		r.ok = r.error.empty();
+	}
+
+	return results;
+}
+
+// One image at a time, each split over worker processes. Nothing else runs threads here, which keeps
+// forking the workers safe.
+vector<pipelineResult> runShardedBatch(const vector<string>& inputs, const vector<string>& outputs, batchOptions* options) {
+	vector<pipelineResult> results(inputs.size());
+
+	shardOptions shards = defaultShardOptions();
+	shards.workers = options->processes;
+	shards.pinWorkers = options->pinProcesses;
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		pipelineResult& r = results[i];
+
+		r.input = inputs[i];
+		r.output = outputs[i];
+		r.compressedBytes = 0;
+		r.codecSeconds = r.writeSeconds = 0;
+
+		auto start = chrono::steady_clock::now();
+		Mat_<Vec3b> img = imread(inputs[i], IMREAD_COLOR);
+		r.readSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		r.width = img.cols;
+		r.height = img.rows;
+		r.rawBytes = (size_t)r.width * r.height * 3;
+
+		vector<uint8_t> stream;
+
+		if (img.empty()) {
+			r.error = "cannot read the image";
+		}
+		else {
+			start = chrono::steady_clock::now();
+
+			if (!encodeSharded(img, options->pipeline.quality, options->pipeline.subsampling, &shards, stream)) {
+				r.error = "a worker process failed";
+			}
+
+			r.codecSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			r.compressedBytes = stream.size();
+		}
+
+		if (r.error.empty()) {
+			start = chrono::steady_clock::now();
+
+			if (!writeFileBytes(r.output.c_str(), stream.data(), stream.size())) {
+				r.error = "cannot write the output";
+			}
+
+			r.writeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+
+		r.ok = r.error.empty();
+	}
+
+	return results;
+}
+
+void printWorkerStatistics(const vector<workerStatistics>& statistics) {
+	for (size_t i = 0; i < statistics.size(); i++) {
+		const workerStatistics& s = statistics[i];
+
+		printf("Worker %zu: %lld tasks (%lld stolen), busy %.3f s, utilization %.0f%%\n",
+			i, s.tasksExecuted, s.tasksStolen, s.busySeconds, s.utilization * 100);
+	}
+}
+
+// *************************************************************************************************
+//							Report
+// *************************************************************************************************
+
+string jsonEscape(const string& text) {
+	string escaped;
+
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+
+		escaped += c;
+	}
+
+	return escaped;
+}
+
+double megapixels(const pipelineResult& r) {
+	return (double)r.width * r.height / 1e6;
+}
+
+double compressionRatio(const pipelineResult& r) {
+	return r.compressedBytes ? (double)r.rawBytes / r.compressedBytes : 0.0;
+}
+
+void printReport(vector<pipelineResult>& results, batchOptions* options, pipelineCacheStatistics* cacheStatistics, double wallSeconds) {
+	pipelineOptions* pipeline = &options->pipeline;
+
+	double totalMegapixels = 0;
+	double readSeconds = 0;
+	double codecSeconds = 0;
+	double writeSeconds = 0;
+	size_t rawBytes = 0;
+	size_t compressedBytes = 0;
+	int failed = 0;
+
+	for (const pipelineResult& r : results) {
+		if (!r.ok) {
+			failed++;
+			continue;
+		}
+
+		totalMegapixels += megapixels(r);
+		readSeconds += r.readSeconds;
+		codecSeconds += r.codecSeconds;
+		writeSeconds += r.writeSeconds;
+		rawBytes += r.rawBytes;
+		compressedBytes += r.compressedBytes;
+	}
+
+	// MB/s counts the uncompressed pixel bytes, so compression and decompression rates compare directly
+	double wallMPs = wallSeconds > 0 ? totalMegapixels / wallSeconds : 0;
+	double wallMBs = wallSeconds > 0 ? rawBytes / 1e6 / wallSeconds : 0;
+	double totalRatio = compressedBytes ? (double)rawBytes / compressedBytes : 0;
+	long long cacheLookups = cacheStatistics->hits + cacheStatistics->misses;
+	double cacheHitRate = cacheLookups ? 100.0 * cacheStatistics->hits / cacheLookups : 0.0;
+
+	if (options->json) {
+		printf("{\n  \"mode\": \"%s\",\n  \"quality\": %d,\n  \"subsampling\": \"%s\",\n  \"block_size\": %d,\n  \"read_threads\": %d,\n  \"codec_threads\": %d,\n  \"write_threads\": %d,\n  \"files\": [\n",
+			pipeline->decompress ? "decompress" : "compress", pipeline->quality, pipeline->subsampling ? "420" : "444", pipeline->blockSize,
+			pipeline->readThreads, pipeline->codecThreads, pipeline->writeThreads);
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const pipelineResult& r = results[i];
+
+			printf("    { \"input\": \"%s\", \"output\": \"%s\", \"ok\": %s, \"error\": \"%s\", \"width\": %d, \"height\": %d, "
+				"\"raw_bytes\": %zu, \"compressed_bytes\": %zu, \"read_seconds\": %.6f, \"codec_seconds\": %.6f, \"write_seconds\": %.6f, "
+				"\"mp_per_s\": %.3f, \"mb_per_s\": %.3f, \"ratio\": %.3f }%s\n",
+				jsonEscape(r.input).c_str(), jsonEscape(r.output).c_str(), r.ok ? "true" : "false", jsonEscape(r.error).c_str(), r.width, r.height,
+				r.rawBytes, r.compressedBytes, r.readSeconds, r.codecSeconds, r.writeSeconds,
+				r.codecSeconds > 0 ? megapixels(r) / r.codecSeconds : 0, r.codecSeconds > 0 ? r.rawBytes / 1e6 / r.codecSeconds : 0,
+				compressionRatio(r), i + 1 < results.size() ? "," : "");
+		}
+
+		printf("  ],\n");
+
+		if (pipeline->cacheBytes > 0) {
+			printf("  \"block_cache\": { \"bytes_per_thread\": %zu, \"hits\": %lld, \"misses\": %lld, \"hit_rate\": %.3f, \"evictions\": %lld },\n",
+				pipeline->cacheBytes, cacheStatistics->hits, cacheStatistics->misses, cacheHitRate, cacheStatistics->evictions);
+		}
+
+		printf("  \"total\": { \"files\": %zu, \"failed\": %d, \"megapixels\": %.3f, \"raw_bytes\": %zu, \"compressed_bytes\": %zu, "
+			"\"wall_seconds\": %.6f, \"read_seconds\": %.6f, \"codec_seconds\": %.6f, \"write_seconds\": %.6f, "
+			"\"mp_per_s\": %.3f, \"mb_per_s\": %.3f, \"ratio\": %.3f }\n}\n",
+			results.size(), failed, totalMegapixels, rawBytes, compressedBytes, wallSeconds, readSeconds, codecSeconds, writeSeconds,
+			wallMPs, wallMBs, totalRatio);
+
+		return;
+	}
+
+	for (const pipelineResult& r : results) {
+		if (!r.ok) {
+			printf("%s: %s\n", r.input.c_str(), r.error.c_str());
+			continue;
+		}
+
+		printf("%s -> %s: %dx%d, %zu bytes, %.3f s, %.2f MP/s, %.2f MB/s, ratio %.2f\n",
+			r.input.c_str(), r.output.c_str(), r.width, r.height, r.compressedBytes, r.codecSeconds,
+			megapixels(r) / r.codecSeconds, r.rawBytes / 1e6 / r.codecSeconds, compressionRatio(r));
+	}
+
+	// stage times are summed over their threads; with the stages overlapped the wall time stays below their sum
+	printf("Stages: read %.3f s, %s %.3f s, write %.3f s\n", readSeconds, pipeline->decompress ? "decompress" : "compress", codecSeconds, writeSeconds);
+	printf("Total: %zu files (%d failed), %.2f MP in %.3f s, %.2f MP/s, %.2f MB/s, ratio %.2f\n",
+		results.size(), failed, totalMegapixels, wallSeconds, wallMPs, wallMBs, totalRatio);
+
+	// summed over the caches of the codec threads, each of which sees only the files it coded
+	if (pipeline->cacheBytes > 0) {
+		printf("Block cache: %lld hits, %lld misses (%.1f%% hit rate), %lld evictions, %zu bytes per coding thread\n",
+			cacheStatistics->hits, cacheStatistics->misses, cacheHitRate, cacheStatistics->evictions, pipeline->cacheBytes);
+	}
+}
+
+int main(int argc, char** argv) {
+	batchOptions options;
+
+	if (!parseArguments(argc, argv, &options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	error_code ec;
+	fs::create_directories(options.outputDirectory, ec);
+
+	vector<string> files;
+	vector<string> names;
+	vector<string> outputs;
+
+	collectInputFiles(&options, files, names);
+
+	if (!outputFiles(files, names, &options, outputs)) {
+		return 1;
+	}
+
+	setInstrumentation(options.profile || !options.traceFile.empty());
+	setTracing(!options.traceFile.empty());
+
+	auto start = chrono::steady_clock::now();
+
+	vector<workerStatistics> statistics;
+	vector<pipelineResult> results;
+	pipelineCacheStatistics cacheStatistics = { 0, 0, 0 };
+
+	if (options.scheduled) {
+		results = runScheduledBatch(files, outputs, &options.pipeline, statistics);
+	}
+	else if (options.processes > 0) {
+		results = runShardedBatch(files, outputs, &options);
+	}
+	else {
+		results = runPipeline(files, outputs, &options.pipeline, &cacheStatistics);
+	}
+
+	double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	printReport(results, &options, &cacheStatistics, wallSeconds);
+
+	if (options.scheduled && !options.json) {
+		printWorkerStatistics(statistics);
+	}
+
+	// the worker processes of -p keep their measurements, so only the coordinator's own work shows up here
+	if (options.profile) {
+		printInstrumentationSummary(stderr);
+	}
+
+	if (!options.traceFile.empty() && !writeChromeTrace(options.traceFile.c_str())) {
+		printf("Cannot write %s\n", options.traceFile.c_str());
+	}
+
+	for (const pipelineResult& r : results) {
+		if (!r.ok) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
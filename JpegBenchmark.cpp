@@ -0,0 +1,641 @@
+// JpegBenchmark.cpp : Times every stage of the block pipeline on its own, and whole images end to end.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+
+using namespace cv;
+using namespace std;
+
+#define BENCHMARK_FILE "benchmark.bin"
+#define RANDOM_BLOCKS 256
+
+// *************************************************************************************************
+//							Allocation Counting
+// *************************************************************************************************
+
+// The codec allocates with calloc and through cv::Mat, which ends in malloc, so counting is done at
+// malloc itself. That only works where the C library lets a program replace it (glibc); elsewhere
+// the allocation column reads n/a.
+static atomic<long long> allocations(0);
+
+#if defined(__GLIBC__) && !defined(NO_ALLOCATION_COUNTING)
+#define COUNTING_ALLOCATIONS 1
+
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* p, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void __libc_free(void* p);
+
+	void* malloc(size_t size) {
+		allocations.fetch_add(1, memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size) {
+		allocations.fetch_add(1, memory_order_relaxed);
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* p, size_t size) {
+		allocations.fetch_add(1, memory_order_relaxed);
+		return __libc_realloc(p, size);
+	}
+
+	int posix_memalign(void** p, size_t alignment, size_t size) {
+		allocations.fetch_add(1, memory_order_relaxed);
+		*p = __libc_memalign(alignment, size);
+		return *p != NULL ? 0 : ENOMEM;
+	}
+
+	void free(void* p) {
+		__libc_free(p);
+	}
+}
+#else
+#define COUNTING_ALLOCATIONS 0
+#endif
+
+// *************************************************************************************************
+//							Harness
+// *************************************************************************************************
+
+// Keeps the compiler from dropping a result nobody reads
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#ifdef _MSC_VER
+	static volatile const void* sink;
+	sink = &value;
+#else
+	asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+typedef struct {
+	long long iterations;
+	long long done;
+	chrono::steady_clock::time_point start;
+	double seconds;
+	long long allocations;
+}benchmarkState;
+
+// for (startIterations(state); keepRunning(state);) { ... } runs the body state->iterations times and times it
+void startIterations(benchmarkState* state) {
+	state->done = 0;
+	state->allocations = allocations.load();
+	state->start = chrono::steady_clock::now();
+}
+
+bool keepRunning(benchmarkState* state) {
+	if (state->done++ < state->iterations) {
+		return true;
+	}
+
+	state->seconds = chrono::duration<double>(chrono::steady_clock::now() - state->start).count();
+	state->allocations = allocations.load() - state->allocations;
+
+	return false;
+}
+
+typedef struct {
+	string name;
+	void (*run)(benchmarkState* state, void* argument);
+	void* argument;
+	// operations of one iteration are whole images for the image benchmarks; this converts them to blocks
+	double blocksPerIteration;
+}benchmark;
+
+typedef struct {
+	double minSeconds;
+	string filter;
+	bool csv;
+}benchmarkOptions;
+
+// Like Google Benchmark: the iteration count grows until one run lasts at least minSeconds
+void runBenchmark(benchmark* b, benchmarkOptions* options) {
+	benchmarkState state;
+	state.iterations = 1;
+
+	while (true) {
+		b->run(&state, b->argument);
+
+		if (state.seconds >= options->minSeconds || state.iterations >= (1LL << 40)) {
+			break;
+		}
+
+		double scale = state.seconds > 0 ? 1.4 * options->minSeconds / state.seconds : 100;
+		state.iterations = (long long)(state.iterations * minInt(maxInt((int)scale, 2), 100));
+	}
+
+	double blocks = state.iterations * b->blocksPerIteration;
+	double nsPerIteration = state.seconds * 1e9 / state.iterations;
+	double nsPerBlock = state.seconds * 1e9 / blocks;
+	double allocationsPerBlock = state.allocations / blocks;
+
+	if (options->csv) {
+		printf("%s,%lld,%.1f,%.1f,%.0f,", b->name.c_str(), state.iterations, nsPerIteration, nsPerBlock, blocks / state.seconds);
+		COUNTING_ALLOCATIONS ? printf("%.2f\n", allocationsPerBlock) : printf("\n");
+		return;
+	}
+
+	printf("%-40s %12lld %14.1f %12.1f %14.0f ", b->name.c_str(), state.iterations, nsPerIteration, nsPerBlock, blocks / state.seconds);
+	COUNTING_ALLOCATIONS ? printf("%14.2f\n", allocationsPerBlock) : printf("%14s\n", "n/a");
+}
+
+// *************************************************************************************************
+//							Inputs
+// *************************************************************************************************
+
+// Every stage takes the output of the previous one, so the inputs of all the stages are prepared up
+// front from the same blocks and each benchmark only times its own stage
+typedef struct {
+	vector<Mat_<uchar>> blocks;
+	vector<Mat_<float>> signedBlocks;
+	vector<Mat_<float>> transformed;
+	vector<Mat_<char>> quantized;
+	vector<vector<char>> zigZag;
+	vector<vector<rleElement>> code;
+	vector<Mat_<float>> dequantized;
+	vector<Mat_<float>> reconstructed;
+	Mat_<uchar> plane;
+	int quality;
+}blockInputs;
+
+// A smooth gradient, the kind of block most of a photograph is made of
+Mat_<uchar> fixedBlock() {
+	Mat_<uchar> block(8, 8);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			block(i, j) = (uchar)(96 + 6 * i + 3 * j);
+		}
+	}
+
+	return block;
+}
+
+// Blocks of noise over a random level, coarse to fine, so the runs and code lengths vary
+Mat_<uchar> randomBlock(mt19937& generator) {
+	Mat_<uchar> block(8, 8);
+
+	int level = generator() % 200 + 28;
+	int amplitude = generator() % 28 + 1;
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			block(i, j) = (uchar)(level + (int)(generator() % (2 * amplitude)) - amplitude);
+		}
+	}
+
+	return block;
+}
+
+void prepareInputs(blockInputs* inputs, bool randomized, int quality) {
+	mt19937 generator(2024);
+	int count = randomized ? RANDOM_BLOCKS : 1;
+
+	inputs->quality = quality;
+
+	for (int k = 0; k < count; k++) {
+		Mat_<uchar> block = randomized ? randomBlock(generator) : fixedBlock();
+
+		inputs->blocks.push_back(block);
+		inputs->signedBlocks.push_back(convertToSigned(block));
+		inputs->transformed.push_back(discreteCosineTransform(inputs->signedBlocks.back()));
+		inputs->quantized.push_back(quantization(inputs->transformed.back(), quality));
+
+		char* vals = zigZagTraversal(inputs->quantized.back());
+		inputs->zigZag.push_back(vector<char>(vals, vals + COEFFICIENTS_PER_BLOCK));
+
+		int len = 0;
+		rleElement* code = rle(vals, COEFFICIENTS_PER_BLOCK, &len);
+		inputs->code.push_back(vector<rleElement>(code, code + len));
+
+		inputs->dequantized.push_back(dequantization(inputs->quantized.back(), quality));
+		inputs->reconstructed.push_back(inverseDiscreteCosineTransform(inputs->dequantized.back()));
+
+		free(code);
+		free(vals);
+	}
+
+	inputs->plane = Mat_<uchar>(256, 256);
+
+	for (int i = 0; i < inputs->plane.rows; i++) {
+		for (int j = 0; j < inputs->plane.cols; j++) {
+			inputs->plane(i, j) = randomized ? (uchar)generator() : (uchar)(i + j);
+		}
+	}
+}
+
+Mat_<Vec3b> syntheticImage(int width, int height) {
+	Mat_<Vec3b> img(height, width);
+	mt19937 generator(7);
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			int noise = generator() % 9;
+			img(i, j) = Vec3b((uchar)((i * 255 / height + noise) & 255), (uchar)((j * 255 / width + noise) & 255), (uchar)(((i ^ j) & 63) + 96));
+		}
+	}
+
+	return img;
+}
+
+// *************************************************************************************************
+//							Compression Stages
+// *************************************************************************************************
+
+void benchmarkGetBlock(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	int blocksX = inputs->plane.cols / 8;
+	int blocks = blocksX * (inputs->plane.rows / 8);
+	long long k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		int index = (int)(k % blocks);
+		doNotOptimize(get8x8BlockAt(index % blocksX, index / blocksX, inputs->plane));
+	}
+}
+
+void benchmarkConvertToSigned(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(convertToSigned(inputs->blocks[k % inputs->blocks.size()]));
+	}
+}
+
+void benchmarkDiscreteCosineTransform(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(discreteCosineTransform(inputs->signedBlocks[k % inputs->signedBlocks.size()]));
+	}
+}
+
+void benchmarkQuantization(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(quantization(inputs->transformed[k % inputs->transformed.size()], inputs->quality));
+	}
+}
+
+void benchmarkZigZagTraversal(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		char* vals = zigZagTraversal(inputs->quantized[k % inputs->quantized.size()]);
+		doNotOptimize(vals);
+		free(vals);
+	}
+}
+
+void benchmarkRle(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		int len = 0;
+		rleElement* code = rle(inputs->zigZag[k % inputs->zigZag.size()].data(), COEFFICIENTS_PER_BLOCK, &len);
+		doNotOptimize(code);
+		free(code);
+	}
+}
+
+void benchmarkEncodeBlock(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		int len = 0;
+		rleElement* code = encodeBlock(inputs->blocks[k % inputs->blocks.size()], &len, inputs->quality);
+		doNotOptimize(code);
+		free(code);
+	}
+}
+
+void benchmarkEncodeBlockCached(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	blockCache cache = createBlockCache(1 << 20);
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		int len = 0;
+		rleElement* code = encodeBlockCached(&cache, inputs->blocks[k % inputs->blocks.size()], &len, inputs->quality);
+		doNotOptimize(code);
+		free(code);
+	}
+}
+
+void benchmarkWriteBlock(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	remove(BENCHMARK_FILE);
+
+	for (startIterations(state); keepRunning(state); k++) {
+		writeBlock(inputs->code[k % inputs->code.size()].data(), (char*)BENCHMARK_FILE);
+	}
+
+	remove(BENCHMARK_FILE);
+}
+
+// *************************************************************************************************
+//							Decompression Stages
+// *************************************************************************************************
+
+void benchmarkReadBlock(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+
+	remove(BENCHMARK_FILE);
+
+	for (vector<rleElement>& code : inputs->code) {
+		writeBlock(code.data(), (char*)BENCHMARK_FILE);
+	}
+
+	FILE* pf = fopen(BENCHMARK_FILE, "rb");
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		if (k % inputs->code.size() == 0) {
+			rewind(pf);
+		}
+
+		rleElement* code = readBlock(pf);
+		doNotOptimize(code);
+		free(code);
+	}
+
+	fclose(pf);
+	remove(BENCHMARK_FILE);
+}
+
+void benchmarkRleDecode(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		char* decoded = rleDecode(inputs->code[k % inputs->code.size()].data());
+		doNotOptimize(decoded);
+		free(decoded);
+	}
+}
+
+void benchmarkZigZagReconstruction(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(zigZagReconstruction(inputs->zigZag[k % inputs->zigZag.size()].data()));
+	}
+}
+
+void benchmarkDequantization(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(dequantization(inputs->quantized[k % inputs->quantized.size()], inputs->quality));
+	}
+}
+
+void benchmarkInverseDiscreteCosineTransform(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(inverseDiscreteCosineTransform(inputs->dequantized[k % inputs->dequantized.size()]));
+	}
+}
+
+void benchmarkConvertToUnsigned(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(convertToUnsigned(inputs->reconstructed[k % inputs->reconstructed.size()]));
+	}
+}
+
+void benchmarkDecompressBlock(benchmarkState* state, void* argument) {
+	blockInputs* inputs = (blockInputs*)argument;
+	size_t k = 0;
+
+	for (startIterations(state); keepRunning(state); k++) {
+		doNotOptimize(decompressBLock(inputs->code[k % inputs->code.size()].data(), inputs->quality));
+	}
+}
+
+// *************************************************************************************************
+//							Whole Images
+// *************************************************************************************************
+
+typedef struct {
+	Mat_<Vec3b> img;
+	int quality;
+	int blockSize;
+	int sizeX;
+	int sizeY;
+	vector<uint8_t> stream;
+}imageInputs;
+
+void prepareImage(imageInputs* inputs, int width, int height, int quality, int blockSize) {
+	inputs->img = syntheticImage(width, height);
+	inputs->quality = quality;
+	inputs->blockSize = blockSize;
+	inputs->sizeX = getNumberOfBlocksX(inputs->img, blockSize);
+	inputs->sizeY = getNumberOfBlocksY(inputs->img, blockSize);
+
+	Encoder encoder(quality);
+	encoder.setBlockSize(blockSize);
+	encoder.encode(inputs->img, inputs->stream);
+}
+
+void benchmarkCompressImage(benchmarkState* state, void* argument) {
+	imageInputs* inputs = (imageInputs*)argument;
+
+	for (startIterations(state); keepRunning(state);) {
+		compressImage(inputs->img, (char*)BENCHMARK_FILE, inputs->quality);
+	}
+
+	remove(BENCHMARK_FILE);
+}
+
+void benchmarkDecompressImage(benchmarkState* state, void* argument) {
+	imageInputs* inputs = (imageInputs*)argument;
+
+	writeFileBytes(BENCHMARK_FILE, inputs->stream.data(), inputs->stream.size());
+
+	for (startIterations(state); keepRunning(state);) {
+		doNotOptimize(decompressImage((char*)BENCHMARK_FILE, inputs->sizeX, inputs->sizeY, inputs->quality));
+	}
+
+	remove(BENCHMARK_FILE);
+}
+
+void benchmarkEncoder(benchmarkState* state, void* argument) {
+	imageInputs* inputs = (imageInputs*)argument;
+	Encoder encoder(inputs->quality);
+	vector<uint8_t> stream;
+
+	encoder.setBlockSize(inputs->blockSize);
+
+	for (startIterations(state); keepRunning(state);) {
+		stream.clear();
+		encoder.encode(inputs->img, stream);
+		doNotOptimize(stream.data());
+	}
+}
+
+void benchmarkDecoder(benchmarkState* state, void* argument) {
+	imageInputs* inputs = (imageInputs*)argument;
+	Decoder decoder(inputs->quality);
+	Mat_<Vec3b> out;
+
+	decoder.setBlockSize(inputs->blockSize);
+
+	for (startIterations(state); keepRunning(state);) {
+		decoder.decode(inputs->stream.data(), inputs->stream.size(), inputs->sizeX, inputs->sizeY, out);
+		doNotOptimize(out.data);
+	}
+}
+
+// *************************************************************************************************
+//							Main
+// *************************************************************************************************
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options]\n", program);
+	printf("  --filter <text>     run only the benchmarks whose name contains text\n");
+	printf("  --min-time <s>      shortest run that is reported (default: 0.5)\n");
+	printf("  -q <1-100>          quality, at most %d (default: %d)\n", maxQuality(), DEFAULT_QUALITY);
+	printf("  --csv               print comma separated values\n");
+}
+
+int main(int argc, char** argv) {
+	benchmarkOptions options;
+	options.minSeconds = 0.5;
+	options.csv = false;
+
+	int quality = DEFAULT_QUALITY;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--filter" && hasValue) {
+			options.filter = argv[++i];
+		}
+		else if (arg == "--min-time" && hasValue) {
+			options.minSeconds = atof(argv[++i]);
+		}
+		else if (arg == "-q" && hasValue) {
+			quality = checkQualityArgument(atoi(argv[++i]));
+		}
+		else if (arg == "--csv") {
+			options.csv = true;
+		}
+		else {
+			printUsage(argv[0]);
+			return 2;
+		}
+	}
+
+	blockInputs fixedInputs, randomInputs;
+	prepareInputs(&fixedInputs, false, quality);
+	prepareInputs(&randomInputs, true, quality);
+
+	struct {
+		const char* name;
+		void (*run)(benchmarkState*, void*);
+	} stages[] = {
+		{ "get8x8BlockAt", benchmarkGetBlock },
+		{ "convertToSigned", benchmarkConvertToSigned },
+		{ "discreteCosineTransform", benchmarkDiscreteCosineTransform },
+		{ "quantization", benchmarkQuantization },
+		{ "zigZagTraversal", benchmarkZigZagTraversal },
+		{ "rle", benchmarkRle },
+		{ "encodeBlock", benchmarkEncodeBlock },
+		{ "encodeBlockCached", benchmarkEncodeBlockCached },
+		{ "writeBlock", benchmarkWriteBlock },
+		{ "readBlock", benchmarkReadBlock },
+		{ "rleDecode", benchmarkRleDecode },
+		{ "zigZagReconstruction", benchmarkZigZagReconstruction },
+		{ "dequantization", benchmarkDequantization },
+		{ "inverseDiscreteCosineTransform", benchmarkInverseDiscreteCosineTransform },
+		{ "convertToUnsigned", benchmarkConvertToUnsigned },
+		{ "decompressBLock", benchmarkDecompressBlock },
+	};
+
+	vector<benchmark> benchmarks;
+
+	for (auto& stage : stages) {
+		benchmarks.push_back({ string(stage.name) + "/fixed", stage.run, &fixedInputs, 1 });
+		benchmarks.push_back({ string(stage.name) + "/random", stage.run, &randomInputs, 1 });
+	}
+
+	int resolutions[][2] = { { 256, 256 }, { 640, 480 }, { 1920, 1080 } };
+	imageInputs images[3];
+
+	for (int r = 0; r < 3; r++) {
+		int width = resolutions[r][0];
+		int height = resolutions[r][1];
+		string size = "/" + to_string(width) + "x" + to_string(height);
+
+		prepareImage(&images[r], width, height, quality, DEFAULT_BLOCK_SIZE);
+
+		double blocks = (double)images[r].sizeX * images[r].sizeY * COMPONENTS;
+
+		benchmarks.push_back({ "compressImage" + size, benchmarkCompressImage, &images[r], blocks });
+		benchmarks.push_back({ "decompressImage" + size, benchmarkDecompressImage, &images[r], blocks });
+		benchmarks.push_back({ "Encoder::encode" + size, benchmarkEncoder, &images[r], blocks });
+		benchmarks.push_back({ "Decoder::decode" + size, benchmarkDecoder, &images[r], blocks });
+	}
+
+	// the other block sizes on the largest image; ns/block is then per block of that size
+	int blockSizes[] = { 4, 16 };
+	imageInputs blockSizeImages[2];
+
+	for (int k = 0; k < 2; k++) {
+		int n = blockSizes[k];
+		string size = "/1920x1080/" + to_string(n) + "x" + to_string(n);
+
+		prepareImage(&blockSizeImages[k], 1920, 1080, quality, n);
+
+		double blocks = (double)blockSizeImages[k].sizeX * blockSizeImages[k].sizeY * COMPONENTS;
+
+		benchmarks.push_back({ "Encoder::encode" + size, benchmarkEncoder, &blockSizeImages[k], blocks });
+		benchmarks.push_back({ "Decoder::decode" + size, benchmarkDecoder, &blockSizeImages[k], blocks });
+	}
+
+	if (options.csv) {
+		printf("name,iterations,ns_per_iteration,ns_per_block,blocks_per_s,allocations_per_block\n");
+	}
+	else {
+		printf("%-40s %12s %14s %12s %14s %14s\n", "Benchmark", "Iterations", "ns/iteration", "ns/block", "blocks/s", "allocs/block");
+		printf("%s\n", string(111, '-').c_str());
+	}
+
+	for (benchmark& b : benchmarks) {
+		if (b.name.find(options.filter) == string::npos) {
+			continue;
+		}
+
+		runBenchmark(&b, &options);
+		fflush(stdout);
+	}
+
+	return 0;
+}
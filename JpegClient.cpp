@@ -0,0 +1,436 @@
+// JpegClient.cpp : Command line client of the compression daemon, also used to load it in tests.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "DaemonProtocol.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+
+int main() {
+	puts("The client needs Unix domain sockets and POSIX shared memory, which this platform does not have");
+	return 1;
+}
+
+#else
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+namespace fs = std::filesystem;
+
+typedef struct {
+	string socketPath;
+	string command;
+	vector<string> files;
+	string outputDirectory;
+	string decompressedExtension;
+	int quality;
+	bool subsampling;
+	uint64_t sharedThreshold;
+	// every file is sent this many times, which turns the client into a load generator
+	int repeat;
+}clientOptions;
+
+typedef struct {
+	string input;
+	string output;
+	char sharedName[SHARED_NAME_LENGTH];
+	chrono::steady_clock::time_point sent;
+	double seconds;
+	int status;
+	size_t bytesIn;
+	size_t bytesOut;
+	bool wasSent;
+	bool answered;
+}clientRequest;
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options] compress|decompress <file>... | stats\n", program);
+	printf("  -S <path>       socket path (default: %s)\n", DAEMON_SOCKET);
+	printf("  -o <dir>        output directory (default: .)\n");
+	printf("  -q <1-100>      quality, at most %d (default: %d)\n", maxQuality(), DEFAULT_QUALITY);
+	printf("  -s <444|420>    420 blurs the chroma over 2x2 pixels, which is still coded at full size (default: 444)\n");
+	printf("  -m <bytes>      payloads above this go through shared memory, 0 never (default: %d)\n", DEFAULT_SHARED_THRESHOLD);
+	printf("  -e <ext>        extension of decompressed images (default: .bmp)\n");
+	printf("  -n <times>      send every file this many times (default: 1)\n");
+}
+
+bool parseArguments(int argc, char** argv, clientOptions* options) {
+	options->socketPath = DAEMON_SOCKET;
+	options->outputDirectory = ".";
+	options->decompressedExtension = ".bmp";
+	options->quality = DEFAULT_QUALITY;
+	options->subsampling = false;
+	options->sharedThreshold = DEFAULT_SHARED_THRESHOLD;
+	options->repeat = 1;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "-S" && hasValue) {
+			options->socketPath = argv[++i];
+		}
+		else if (arg == "-o" && hasValue) {
+			options->outputDirectory = argv[++i];
+		}
+		else if (arg == "-q" && hasValue) {
+			// the daemon codes 8x8 blocks and refuses the qualities they cannot represent
+			options->quality = checkQualityArgument(atoi(argv[++i]));
+		}
+		else if (arg == "-s" && hasValue) {
+			options->subsampling = string(argv[++i]) == "420";
+		}
+		else if (arg == "-m" && hasValue) {
+			options->sharedThreshold = strtoull(argv[++i], NULL, 10);
+		}
+		else if (arg == "-e" && hasValue) {
+			options->decompressedExtension = argv[++i];
+
+			if (options->decompressedExtension[0] != '.') {
+				options->decompressedExtension = "." + options->decompressedExtension;
+			}
+		}
+		else if (arg == "-n" && hasValue) {
+			options->repeat = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg[0] == '-') {
+			return false;
+		}
+		else if (options->command.empty()) {
+			options->command = arg;
+		}
+		else {
+			options->files.push_back(arg);
+		}
+	}
+
+	if (options->command == "stats") {
+		return options->files.empty();
+	}
+
+	return (options->command == "compress" || options->command == "decompress") && !options->files.empty();
+}
+
+int connectToDaemon(const string& path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+		printf("Cannot connect to the daemon on %s\n", path.c_str());
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return -1;
+	}
+
+	return fd;
+}
+
+// Sends a request whose payload goes inline or, above the threshold, through shared memory
+bool sendRequest(int fd, requestHeader* request, const uint8_t* data, size_t size, clientOptions* options, char* sharedName) {
+	request->magic = DAEMON_MAGIC;
+	request->sharedThreshold = options->sharedThreshold;
+	request->payloadSize = size;
+	request->sharedName[0] = 0;
+	sharedName[0] = 0;
+
+	bool shared = options->sharedThreshold > 0 && size > options->sharedThreshold
+		&& createSharedPayload("jpegc", request->id, data, size, request->sharedName);
+
+	if (shared) {
+		strcpy(sharedName, request->sharedName);
+	}
+
+	return sendAll(fd, request, sizeof(requestHeader)) && (shared || sendAll(fd, data, size));
+}
+
+// Reads the payload of an answer and, unless it failed, writes it to the output of its request
+bool receiveAnswer(int fd, responseHeader* response, clientRequest* request, bool decompress) {
+	vector<uint8_t> inlinePayload;
+	const uint8_t* payload = NULL;
+
+	if (response->sharedName[0] != 0) {
+		payload = mapSharedPayload(response->sharedName, response->payloadSize);
+
+		if (payload == NULL && response->payloadSize > 0) {
+			return false;
+		}
+	}
+	else {
+		if (response->payloadSize > MAX_INLINE_PAYLOAD) {
+			return false;
+		}
+
+		inlinePayload.resize(response->payloadSize);
+
+		if (!receiveAll(fd, inlinePayload.data(), inlinePayload.size())) {
+			return false;
+		}
+
+		payload = inlinePayload.data();
+	}
+
+	request->bytesOut = response->payloadSize;
+
+	bool usable = response->status == STATUS_OK || response->status == STATUS_TRUNCATED;
+
+	if (usable && !request->output.empty()) {
+		bool written;
+
+		if (decompress) {
+			Mat_<Vec3b> img(response->height, response->width, (Vec3b*)payload);
+			written = imwrite(request->output, img);
+		}
+		else {
+			written = writeFileBytes(request->output.c_str(), payload, response->payloadSize);
+		}
+
+		if (!written) {
+			printf("Cannot write %s\n", request->output.c_str());
+		}
+	}
+
+	if (response->sharedName[0] != 0 && payload != NULL) {
+		unmapSharedPayload(payload, response->payloadSize);
+	}
+
+	return true;
+}
+
+int printStatistics(int fd) {
+	requestHeader request = {};
+	char sharedName[SHARED_NAME_LENGTH];
+	clientOptions options;
+
+	options.sharedThreshold = 0;
+	request.command = COMMAND_STATS;
+
+	responseHeader response;
+	vector<uint8_t> json;
+
+	if (!sendRequest(fd, &request, NULL, 0, &options, sharedName) || !receiveAll(fd, &response, sizeof(responseHeader))
+		|| response.magic != DAEMON_MAGIC || response.payloadSize > MAX_INLINE_PAYLOAD) {
+		puts("The daemon did not answer");
+		return 1;
+	}
+
+	json.resize(response.payloadSize);
+
+	if (!receiveAll(fd, json.data(), json.size())) {
+		puts("The daemon did not answer");
+		return 1;
+	}
+
+	fwrite(json.data(), 1, json.size(), stdout);
+
+	return 0;
+}
+
+const char* statusText(int status) {
+	switch (status) {
+	case STATUS_OK:
+		return "ok";
+	case STATUS_INVALID_REQUEST:
+		return "invalid request";
+	case STATUS_INVALID_PAYLOAD:
+		return "invalid payload";
+	case STATUS_TRUNCATED:
+		return "truncated stream";
+	default:
+		return "internal error";
+	}
+}
+
+int main(int argc, char** argv) {
+	clientOptions options;
+
+	if (!parseArguments(argc, argv, &options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	int fd = connectToDaemon(options.socketPath);
+
+	if (fd < 0) {
+		return 1;
+	}
+
+	if (options.command == "stats") {
+		int result = printStatistics(fd);
+		close(fd);
+		return result;
+	}
+
+	bool decompress = options.command == "decompress";
+
+	error_code ec;
+	fs::create_directories(options.outputDirectory, ec);
+
+	vector<clientRequest> requests(options.files.size() * options.repeat);
+	map<string, string> writers;
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		const string& input = options.files[i % options.files.size()];
+
+		requests[i].input = input;
+		requests[i].wasSent = requests[i].answered = false;
+		requests[i].sharedName[0] = 0;
+		requests[i].status = STATUS_INTERNAL_ERROR;
+		requests[i].bytesIn = requests[i].bytesOut = 0;
+		requests[i].seconds = 0;
+
+		// repeated sends of a file are not written again
+		if (i < options.files.size()) {
+			string extension = decompress ? options.decompressedExtension : ".jpc";
+			requests[i].output = (fs::path(options.outputDirectory) / fs::path(input).filename().replace_extension(extension)).string();
+
+			// a/img.png and b/img.png, or img.png and img.jpg, would overwrite each other
+			if (writers.count(requests[i].output) > 0) {
+				printf("%s and %s would both be written to %s\n", writers[requests[i].output].c_str(), input.c_str(), requests[i].output.c_str());
+				close(fd);
+				return 1;
+			}
+
+			writers[requests[i].output] = input;
+		}
+	}
+
+	auto start = chrono::steady_clock::now();
+
+	// answers come back while requests are still being sent, so they are read on their own thread;
+	// otherwise a full socket in both directions would stall client and daemon. The daemon closes the
+	// connection once it has answered everything sent before the client shut its side down.
+	thread receiver([&]() {
+		responseHeader response;
+
+		while (receiveAll(fd, &response, sizeof(responseHeader))) {
+			if (response.magic != DAEMON_MAGIC || response.id >= requests.size()) {
+				break;
+			}
+
+			clientRequest* request = &requests[response.id];
+
+			request->seconds = chrono::duration<double>(chrono::steady_clock::now() - request->sent).count();
+			request->status = response.status;
+			request->answered = true;
+
+			// a payload the daemon never mapped is still in shared memory
+			if (request->sharedName[0] != 0 && response.status != STATUS_OK) {
+				shm_unlink(request->sharedName);
+			}
+
+			if (!receiveAnswer(fd, &response, request, decompress)) {
+				request->status = STATUS_INTERNAL_ERROR;
+				break;
+			}
+		}
+	});
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		clientRequest* r = &requests[i];
+		requestHeader request = {};
+		vector<uint8_t> bytes;
+		Mat_<Vec3b> img;
+
+		request.id = (uint32_t)i;
+		request.command = decompress ? COMMAND_DECOMPRESS : COMMAND_COMPRESS;
+		request.quality = options.quality;
+		request.subsampling = options.subsampling;
+
+		const uint8_t* data;
+		size_t size;
+
+		if (decompress) {
+			if (!readFileBytes(r->input.c_str(), bytes)) {
+				continue;
+			}
+
+			data = bytes.data();
+			size = bytes.size();
+		}
+		else {
+			img = imread(r->input, IMREAD_COLOR);
+
+			if (img.empty()) {
+				continue;
+			}
+
+			// the daemon expects the rows back to back
+			if (!img.isContinuous()) {
+				img = img.clone();
+			}
+
+			request.width = img.cols;
+			request.height = img.rows;
+			data = img.data;
+			size = (size_t)img.rows * img.cols * sizeof(Vec3b);
+		}
+
+		r->bytesIn = size;
+		r->sent = chrono::steady_clock::now();
+
+		if (!sendRequest(fd, &request, data, size, &options, r->sharedName)) {
+			puts("The daemon closed the connection");
+			break;
+		}
+
+		r->wasSent = true;
+	}
+
+	shutdown(fd, SHUT_WR);
+	receiver.join();
+	close(fd);
+
+	double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	vector<double> latencies;
+	int failed = 0;
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		clientRequest* r = &requests[i];
+
+		if (!r->answered || r->status != STATUS_OK) {
+			failed++;
+		}
+
+		if (r->answered) {
+			latencies.push_back(r->seconds);
+		}
+
+		if (i < options.files.size()) {
+			printf("%s -> %s: %s, %zu -> %zu bytes, %.3f ms\n", r->input.c_str(), r->output.c_str(),
+				r->answered ? statusText(r->status) : r->wasSent ? "no answer" : "cannot read the input", r->bytesIn, r->bytesOut, r->seconds * 1000);
+		}
+	}
+
+	sort(latencies.begin(), latencies.end());
+
+	if (!latencies.empty()) {
+		printf("Total: %zu requests (%d failed) in %.3f s, %.1f requests/s, latency p50 %.3f ms, p99 %.3f ms\n",
+			requests.size(), failed, wallSeconds, requests.size() / wallSeconds,
+			latencies[latencies.size() / 2] * 1000, latencies[minInt((int)(latencies.size() * 0.99), (int)latencies.size() - 1)] * 1000);
+	}
+
+	return failed > 0 ? 1 : 0;
+}
+
+#endif
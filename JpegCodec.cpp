@@ -0,0 +1,2153 @@
+// JpegCodec.cpp : The compression library: block pipeline, file formats and the in-memory encoder/decoder.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "BlockPipeline.h"
+#include "Instrumentation.h"
+#include <math.h>
+#include <stddef.h>
+
+using namespace cv;
+using namespace std;
+
+rleElement EOB = { (char)255, (uchar)0 };
+
+// *************************************************************************************************
+//							Auxiliary Functions
+// *************************************************************************************************
+
+
+int minInt(int x, int y) {
+	if (x < y) {
+		return x;
+	}
+	else {
+		return y;
+	}
+}
+
+int maxInt(int x, int y) {
+	if (x > y) {
+		return x;
+	}
+	else {
+		return y;
+	}
+}
+
+bool isInside(Mat img, int i, int j) {
+	return (0 <= i && i < img.rows) && (0 <= j && j < img.cols);
+}
+
+int getNumberOfBlocksX(Mat img, int sizeOfBlock) {
+	int blocksX = img.cols / sizeOfBlock;
+
+	if (img.cols % sizeOfBlock) {
+		blocksX++;
+	}
+
+	return blocksX;
+}
+
+int getNumberOfBlocksY(Mat img, int sizeOfBlock) {
+	int blocksY = img.rows / sizeOfBlock;
+
+	if (img.rows % sizeOfBlock) {
+		blocksY++;
+	}
+
+	return blocksY;
+}
+
+bool isSupportedBlockSize(int blockSize) {
+	return blockSize == 4 || blockSize == 8 || blockSize == 16;
+}
+
+int maxQuality(int blockSize) {
+	constexpr int highest4 = maxQualityOf<4>();
+	constexpr int highest8 = maxQualityOf<8>();
+	constexpr int highest16 = maxQualityOf<16>();
+
+	switch (blockSize) {
+	case 4:
+		return highest4;
+	case 16:
+		return highest16;
+	default:
+		return highest8;
+	}
+}
+
+int effectiveQuality(int quality, int blockSize) {
+	return minInt(maxInt(quality, 1), maxQuality(blockSize));
+}
+
+int checkQualityArgument(int quality, int blockSize) {
+	int used = effectiveQuality(quality, blockSize);
+
+	if (used != quality) {
+		// on stderr, so that a JSON report on stdout stays valid
+		fprintf(stderr, "Quality %d is coded as %d, the highest %dx%d blocks can represent\n", quality, used, blockSize, blockSize);
+	}
+
+	return used;
+}
+
+// Scales the base table the same way as the IJG encoder; quality 50 gives the base table itself
+Mat_<uchar> quantizationTable(int quality) {
+	Mat_<uchar> q(8, 8);
+
+	scaledQuantizationTable<8>(quality, q.data);
+
+	return q;
+}
+
+Mat_<uchar> get8x8BlockAt(int x, int y, Mat_<uchar> img) {
+	Mat_<uchar> block(8, 8);
+
+	getBlockSamples<8>(img, x, y, block.data);
+
+	return block;
+}
+
+Mat_<uchar> getLuminance(Mat_<Vec3b> img) {
+	Mat_<uchar> y(img.rows, img.cols);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			y(i, j) = img(i, j)[0];
+		}
+	}
+
+	return y;
+}
+
+Mat_<uchar> getRedChromatics(Mat_<Vec3b> img) {
+	Mat_<uchar> cr(img.rows, img.cols);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			cr(i, j) = img(i, j)[1];
+		}
+	}
+
+	return cr;
+}
+
+Mat_<uchar> getBlueChromatics(Mat_<Vec3b> img) {
+	Mat_<uchar> cb(img.rows, img.cols);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			cb(i, j) = img(i, j)[2];
+		}
+	}
+
+	return cb;
+}
+
+// *************************************************************************************************
+//							Compression
+// *************************************************************************************************
+
+
+Mat_<uchar> chromaticDownsampling(Mat_<uchar> component) {
+	PROFILE_SCOPE(ZONE_CHROMA_DOWNSAMPLING);
+
+	int blocksX = getNumberOfBlocksX(component, 2);
+	int blocksY = getNumberOfBlocksY(component, 2);
+
+	Mat_<uchar> reducedComponent(blocksY, blocksX);
+
+	for (int x = 0; x < blocksX; x++) {
+		for (int y = 0; y < blocksY; y++) {
+			int sum = 0;
+			int num = 0;
+
+			if (isInside(component, 2 * y, 2 * x)) {
+				sum += component(2 * y, 2 * x);
+				num++;
+			}
+
+			if (isInside(component, 2 * y + 1, 2 * x)) {
+				sum += component(2 * y + 1, 2 * x);
+				num++;
+			}
+
+			if (isInside(component, 2 * y, 2 * x + 1)) {
+				sum += component(2 * y, 2 * x + 1);
+				num++;
+			}
+
+			if (isInside(component, 2 * y + 1, 2 * x + 1)) {
+				sum += component(2 * y + 1, 2 * x + 1);
+				num++;
+			}
+
+			uchar avg = (uchar)round((float)sum / num);
+
+			reducedComponent(y, x) = avg;
+		}
+	}
+
+	return reducedComponent;
+}
+
+Mat_<Vec3b> colorSpaceConversion(Mat_<Vec3b> img) {
+	Mat_<Vec3b> convertedImg(img.rows, img.cols);
+	Mat_<Vec3b> imgOut(img.rows, img.cols);
+
+	cvtColor(img, convertedImg, COLOR_BGR2YCrCb);
+
+	int blocksX = getNumberOfBlocksX(img, 2);
+	int blocksY = getNumberOfBlocksY(img, 2);
+
+	Mat_<uchar> y(img.rows, img.cols);
+	Mat_<uchar> cr(img.rows, img.cols);
+	Mat_<uchar> cb(img.rows, img.cols);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			y(i, j) = convertedImg(i, j)[0];
+			cr(i, j) = convertedImg(i, j)[1];
+			cb(i, j) = convertedImg(i, j)[2];
+		}
+	}
+
+	Mat_<uchar> smallCr(blocksY, blocksX);
+	Mat_<uchar> smallCb(blocksY, blocksX);
+
+	smallCr = chromaticDownsampling(cr);
+	smallCb = chromaticDownsampling(cb);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			imgOut(i, j)[0] = convertedImg(i, j)[0];
+		}
+	}
+
+	for (int x = 0; x < blocksX; x++) {
+		for (int y = 0; y < blocksY; y++) {
+			if (isInside(imgOut, 2 * y, 2 * x)) {
+				imgOut(2 * y, 2 * x)[1] = smallCr(y, x);
+				imgOut(2 * y, 2 * x)[2] = smallCb(y, x);
+			}
+
+			if (isInside(imgOut, 2 * y + 1, 2 * x)) {
+				imgOut(2 * y + 1, 2 * x)[1] = smallCr(y, x);
+				imgOut(2 * y + 1, 2 * x)[2] = smallCb(y, x);
+			}
+
+			if (isInside(imgOut, 2 * y, 2 * x + 1)) {
+				imgOut(2 * y, 2 * x + 1)[1] = smallCr(y, x);
+				imgOut(2 * y, 2 * x + 1)[2] = smallCb(y, x);
+			}
+
+			if (isInside(imgOut, 2 * y + 1, 2 * x + 1)) {
+				imgOut(2 * y + 1, 2 * x + 1)[1] = smallCr(y, x);
+				imgOut(2 * y + 1, 2 * x + 1)[2] = smallCb(y, x);
+			}
+		}
+	}
+
+	return imgOut;
+}
+
+Mat_<float> convertToSigned(Mat_<uchar> block) {
+	Mat_<float> newBlock(block.rows, block.cols);
+
+	block.convertTo(newBlock, CV_32FC1);
+
+	newBlock = newBlock - 128.0f;
+
+	return newBlock;
+}
+
+float ci(int i, int n) {
+	if (i == 0) {
+		return sqrt(1.0f / n);
+	}
+	else {
+		return sqrt(2.0f / n);
+	}
+}
+
+Mat_<float> discreteCosineTransform(Mat_<float> block) {
+	float values[64];
+	Mat_<float> transformedBlock(8, 8);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			values[8 * i + j] = block(i, j);
+		}
+	}
+
+	forwardDCT<8>(values, (float*)transformedBlock.data);
+
+	return transformedBlock;
+}
+
+
+char quantizeCoefficient(float coefficient, uchar q) {
+	int value = (int)round(coefficient / q);
+
+	return (char)minInt(maxInt(value, -128), 127);
+}
+
+Mat_<char> quantization(Mat_<float> block, int quality) {
+	uchar q[64];
+	float coefficients[64];
+	Mat_<char> qBlock(8, 8);
+
+	scaledQuantizationTable<8>(quality, q);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			coefficients[8 * i + j] = block(i, j);
+		}
+	}
+
+	quantizeBlock<8>(coefficients, q, (char*)qBlock.data);
+
+	return qBlock;
+
+}
+
+char* zigZagTraversal(Mat_<char> mat) {
+	PROFILE_SCOPE(ZONE_ZIGZAG);
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
+
+	char* result = (char*)calloc(mat.rows * mat.cols, sizeof(char));
+	int count = 0;
+
+	int row = 0;
+	int col = 0;
+
+	bool nextRow = false;
+
+	for (int rowLimit = 1; rowLimit <= minInt(mat.rows, mat.cols); rowLimit++) {
+		for (int i = 0; i < rowLimit; i++) {
+			result[count] = mat(row, col);
+			count++;
+
+			if (i == rowLimit - 1) {
+				break;
+			}
+
+			if (nextRow) {
+				row++;
+				col--;
+			}
+			else {
+				row--;
+				col++;
+			}
+		}
+
+		if (rowLimit == minInt(mat.rows, mat.cols)) {
+			break;
+		}
+
+		if (nextRow) {
+			row++;
+			nextRow = false;
+		}
+		else {
+			col++;
+			nextRow = true;
+		}
+	}
+
+	if (row == 0) {
+		if (col == mat.cols - 1) {
+			row++;
+		}
+		else {
+			col++;
+		}
+
+		nextRow = true;
+	}
+	else {
+		if (row == mat.rows - 1) {
+			col++;
+		}
+		else {
+			row++;
+		}
+
+		nextRow = false;
+	}
+
+	for (int leftLimit = maxInt(mat.rows - 1, mat.cols - 1); leftLimit > 0; leftLimit--) {
+		int rightLimit = minInt(leftLimit, minInt(mat.rows, mat.cols));
+
+		for (int i = 0; i < rightLimit; i++) {
+			result[count] = mat(row, col);
+			count++;
+
+			if (i == rightLimit - 1) {
+				break;
+			}
+
+			if (nextRow) {
+				row++;
+				col--;
+			}
+			else {
+				row--;
+				col++;
+			}
+		}
+
+		if (row == 0) {
+			col++;
+			nextRow = true;
+		}
+		else if (col == mat.cols - 1) {
+			row++;
+			nextRow = true;
+		}
+		else if (col == 0) {
+			row++;
+			nextRow = false;
+		}
+		else if (row == mat.rows - 1) {
+			col++;
+			nextRow = false;
+		}
+	}
+
+	return result;
+}
+
+rleElement* rle(char* vals, int len, int* newLen) {
+	PROFILE_SCOPE(ZONE_RLE);
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
+
+	rleElement* encoded = (rleElement*)calloc(len + 1, sizeof(rleElement));
+	int n = 0;
+	int i = 0;
+	while (i < len) {
+		int count = 1;
+
+		while (i < len - 1 && vals[i] == vals[i + 1]) {
+			count++;
+			i++;
+		}
+
+		encoded[n].val = vals[i];
+		encoded[n].count = count;
+		n++;
+
+		i++;
+	}
+
+	encoded[n] = EOB;
+	n++;
+
+	*newLen = n;
+
+	return encoded;
+}
+
+void writeBlock(rleElement* vals, const char* filename) {
+	FILE* pf = fopen(filename, "ab");
+
+	if (pf == NULL) {
+		puts("Error opening the file...");
+		return;
+	}
+
+	int i = 0;
+
+	while (true) {
+		fwrite(&vals[i], sizeof(rleElement), 1, pf);
+
+		if (vals[i].val == EOB.val && vals[i].count == EOB.count) {
+			break;
+		}
+
+		i++;
+	}
+
+	fclose(pf);
+
+}
+
+// A block has at most 64 runs and its EOB; if the file ends or has no EOB within that, the block is
+// completed with an EOB and complete (when given) is set to false
+rleElement* readBlock(FILE* pf, bool* complete) {
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
+
+	rleElement* rleArray = (rleElement*)calloc(COEFFICIENTS_PER_BLOCK + 2, sizeof(rleElement));
+	int count = 0;
+
+	rleElement e;
+
+	while (count < COEFFICIENTS_PER_BLOCK + 1) {
+		if (fread(&e, sizeof(rleElement), 1, pf) != 1) {
+			break;
+		}
+
+		rleArray[count] = e;
+		count++;
+
+		if (e.val == EOB.val && e.count == EOB.count) {
+			return rleArray;
+		}
+	}
+
+	rleArray[count] = EOB;
+
+	if (complete != NULL) {
+		*complete = false;
+	}
+
+	return rleArray;
+}
+
+rleElement* encodeBlock(Mat_<uchar> block, int* len, int quality) {
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
+
+	uchar samples[64];
+	uchar q[64];
+	rleElement code[65];
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			samples[8 * i + j] = block(i, j);
+		}
+	}
+
+	scaledQuantizationTable<8>(quality, q);
+
+	*len = encodeBlockSamples<8>(samples, q, code);
+
+	rleElement* rleEl = (rleElement*)calloc(*len, sizeof(rleElement));
+	memcpy(rleEl, code, *len * sizeof(rleElement));
+
+	return rleEl;
+}
+
+// *************************************************************************************************
+//							Block Cache
+// *************************************************************************************************
+
+
+blockCache createBlockCache(size_t maxBytes) {
+	blockCache cache;
+
+	cache.bytes = 0;
+	cache.maxBytes = maxBytes;
+	cache.hits = 0;
+	cache.misses = 0;
+	cache.evictions = 0;
+
+	return cache;
+}
+
+// What an entry costs the heap: its list node (the entry and two links), its code, and its index node
+// (the key, the iterator, a link and the cached hash) with the bucket pointer it adds
+size_t blockCacheEntrySize(blockCacheEntry* entry) {
+	size_t listNode = sizeof(blockCacheEntry) + 2 * sizeof(void*);
+	size_t indexNode = sizeof(std::pair<const unsigned long long, std::list<blockCacheEntry>::iterator>) + sizeof(void*) + sizeof(size_t);
+
+	return listNode + entry->code.capacity() * sizeof(rleElement) + indexNode + sizeof(void*);
+}
+
+unsigned long long hashBlock(uchar* samples, int quality) {
+	// 64-bit FNV-1a over the samples and the quality the block is quantized with
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (int i = 0; i < 64; i++) {
+		hash = (hash ^ samples[i]) * 1099511628211ULL;
+	}
+
+	return (hash ^ (unsigned long long)quality) * 1099511628211ULL;
+}
+
+// Blocks already seen with the same quality reuse their run-length code instead of going through
+// the DCT and the quantization again; the least recently used entries are dropped to stay in maxBytes
+rleElement* encodeBlockCached(blockCache* cache, Mat_<uchar> block, int* len, int quality) {
+	uchar samples[64];
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			samples[8 * i + j] = block(i, j);
+		}
+	}
+
+	unsigned long long key = hashBlock(samples, quality);
+
+	auto found = cache->index.find(key);
+
+	if (found != cache->index.end()) {
+		blockCacheEntry& entry = *found->second;
+
+		if (entry.quality == quality && memcmp(entry.samples, samples, 64) == 0) {
+			cache->hits++;
+			cache->entries.splice(cache->entries.begin(), cache->entries, found->second);
+
+			*len = (int)entry.code.size();
+			rleElement* rleEl = (rleElement*)calloc(*len, sizeof(rleElement));
+			memcpy(rleEl, entry.code.data(), *len * sizeof(rleElement));
+
+			return rleEl;
+		}
+
+		// a hash collision, the new block takes the place of the old one
+		cache->bytes -= blockCacheEntrySize(&entry);
+		cache->entries.erase(found->second);
+		cache->index.erase(found);
+	}
+
+	cache->misses++;
+
+	rleElement* rleEl = encodeBlock(block, len, quality);
+
+	blockCacheEntry entry;
+	entry.key = key;
+	memcpy(entry.samples, samples, 64);
+	entry.quality = quality;
+	entry.code.assign(rleEl, rleEl + *len);
+
+	size_t size = blockCacheEntrySize(&entry);
+
+	if (size > cache->maxBytes) {
+		return rleEl;
+	}
+
+	while (cache->bytes + size > cache->maxBytes) {
+		blockCacheEntry& last = cache->entries.back();
+
+		cache->bytes -= blockCacheEntrySize(&last);
+		cache->index.erase(last.key);
+		cache->entries.pop_back();
+		cache->evictions++;
+	}
+
+	cache->entries.push_front(std::move(entry));
+	cache->index[key] = cache->entries.begin();
+	cache->bytes += size;
+
+	return rleEl;
+}
+
+void printBlockCacheStatistics(blockCache* cache) {
+	long long lookups = cache->hits + cache->misses;
+
+	printf("Block cache: %lld hits, %lld misses (%.1f%% hit rate), %lld evictions, %zu entries, %zu of %zu bytes\n",
+		cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0, cache->evictions,
+		cache->entries.size(), cache->bytes, cache->maxBytes);
+}
+
+void compressBlock(Mat_<uchar> block, const char* compressedFileName, int quality, blockCache* cache) {
+	int len = 0;
+	rleElement* rleEl = cache != NULL ? encodeBlockCached(cache, block, &len, quality) : encodeBlock(block, &len, quality);
+
+	writeBlock(rleEl, compressedFileName);
+
+	free(rleEl);
+}
+
+void compressImage(Mat_<Vec3b> img, const char* filename, int quality, blockCache* cache) {
+	PROFILE_SCOPE(ZONE_COMPRESS_IMAGE);
+
+	Encoder encoder(quality, cache);
+
+	vector<uint8_t> stream;
+	encoder.encode(img, stream);
+
+	if (!writeFileBytes(filename, stream.data(), stream.size())) {
+		puts("Error opening the file...");
+	}
+}
+
+// *************************************************************************************************
+//							Decompression
+// *************************************************************************************************
+
+
+char* rleDecode(rleElement* e) {
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
+
+	char* decoded = (char*)calloc(64, sizeof(char));
+
+	runLengthDecode<8>(e, decoded);
+
+	return decoded;
+}
+
+Mat_<char> zigZagReconstruction(char* vals) {
+	Mat_<char> mat(8, 8);
+
+	zigZagUnscan<8>(vals, (char*)mat.data);
+
+	return mat;
+}
+
+Mat_<float> dequantization(Mat_<char> qBlock, int quality) {
+	uchar q[64];
+	char quantized[64];
+	Mat_<float> block(8, 8);
+
+	scaledQuantizationTable<8>(quality, q);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			quantized[8 * i + j] = qBlock(i, j);
+		}
+	}
+
+	dequantizeBlock<8>(quantized, q, (float*)block.data);
+
+	return block;
+}
+
+Mat_<float> inverseDiscreteCosineTransform(Mat_<float> tBlock) {
+	float coefficients[64];
+	Mat_<float> block(8, 8);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			coefficients[8 * i + j] = tBlock(i, j);
+		}
+	}
+
+	inverseDCT<8>(coefficients, (float*)block.data);
+
+	return block;
+}
+
+Mat_<uchar> convertToUnsigned(Mat_<float> block) {
+	Mat_<uchar> newBlock(block.rows, block.cols);
+
+	for (int i = 0; i < block.rows; i++) {
+		for (int j = 0; j < block.cols; j++) {
+			newBlock(i, j) = levelShiftSample(block(i, j));
+		}
+	}
+
+	return newBlock;
+}
+
+Mat_<uchar> decompressZigZagBlock(char* decoded, int quality) {
+	uchar q[64];
+	Mat_<uchar> decompressed(8, 8);
+
+	scaledQuantizationTable<8>(quality, q);
+
+	decodeBlockValues<8>(decoded, q, decompressed.data);
+
+	return decompressed;
+}
+
+Mat_<uchar> decompressBLock(rleElement* code, int quality) {
+	uchar q[64];
+	Mat_<uchar> decompressed(8, 8);
+
+	scaledQuantizationTable<8>(quality, q);
+
+	decodeBlockCode<8>(code, q, decompressed.data);
+
+	return decompressed;
+}
+
+Mat_<Vec3b> decompressImage(const char* filename, int sizeX, int sizeY, int quality) {
+	PROFILE_SCOPE(ZONE_DECOMPRESS_IMAGE);
+
+	vector<uint8_t> stream;
+
+	if (!readFileBytes(filename, stream)) {
+		puts("Error opening the file...");
+		return Mat_<Vec3b>(8 * sizeY, 8 * sizeX);
+	}
+
+	Decoder decoder(quality);
+	Mat_<Vec3b> result;
+
+	if (!decoder.decode(stream.data(), stream.size(), sizeX, sizeY, result)) {
+		puts("The compressed file is incomplete...");
+	}
+
+	return result;
+}
+
+// *************************************************************************************************
+//							Library API
+// *************************************************************************************************
+
+bool readFileBytes(const char* filename, vector<uint8_t>& bytes) {
+	PROFILE_SCOPE(ZONE_READ_FILE);
+
+	FILE* pf = fopen(filename, "rb");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	fseek(pf, 0, SEEK_END);
+	bytes.resize(ftell(pf));
+	fseek(pf, 0, SEEK_SET);
+
+	bytes.resize(fread(bytes.data(), 1, bytes.size(), pf));
+
+	fclose(pf);
+
+	return true;
+}
+
+bool writeFileBytes(const char* filename, const uint8_t* bytes, size_t size) {
+	PROFILE_SCOPE(ZONE_WRITE_FILE);
+
+	FILE* pf = fopen(filename, "wb");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	bool written = fwrite(bytes, 1, size, pf) == size;
+
+	fclose(pf);
+
+	return written;
+}
+
+void appendContainerHeader(vector<uint8_t>& out, int width, int height, int quality, int blockSize) {
+	containerHeader header;
+
+	memcpy(header.magic, CONTAINER_MAGIC, sizeof(header.magic));
+	header.width = width;
+	header.height = height;
+	// the quality the tables are scaled with, which is what a reader has to use
+	header.quality = effectiveQuality(quality, blockSize);
+	header.blockSize = blockSize;
+
+	uint8_t* bytes = (uint8_t*)&header;
+	out.insert(out.end(), bytes, bytes + sizeof(containerHeader));
+}
+
+size_t readContainerHeader(const uint8_t* data, size_t size, containerHeader* header) {
+	size_t length = 0;
+
+	if (size >= sizeof(containerHeader) && memcmp(data, CONTAINER_MAGIC, sizeof(header->magic)) == 0) {
+		length = sizeof(containerHeader);
+	}
+	else if (size >= offsetof(containerHeader, blockSize) && memcmp(data, LEGACY_CONTAINER_MAGIC, sizeof(header->magic)) == 0) {
+		length = offsetof(containerHeader, blockSize);
+		header->blockSize = 8;
+	}
+	else {
+		return 0;
+	}
+
+	memcpy(header, data, length);
+
+	if (header->width <= 0 || header->height <= 0 || !isSupportedBlockSize(header->blockSize)) {
+		return 0;
+	}
+
+	// containers written before the quality was capped record the quality asked for, not the one used
+	header->quality = effectiveQuality(header->quality, header->blockSize);
+
+	// a payload of a few bytes must not make the decoder allocate gigabytes
+	if ((long long)header->width * header->height > MAX_CONTAINER_PIXELS) {
+		return 0;
+	}
+
+	long long blocksX = ((long long)header->width + header->blockSize - 1) / header->blockSize;
+	long long blocksY = ((long long)header->height + header->blockSize - 1) / header->blockSize;
+
+	if (blocksX * blocksY * COMPONENTS > (long long)((size - length) / sizeof(rleElement))) {
+		return 0;
+	}
+
+	return length;
+}
+
+void splitComponents(const Mat_<Vec3b>& img, Mat_<Vec3b>& converted, Mat_<uchar>* planes, bool subsampling) {
+	PROFILE_SCOPE(ZONE_COLOR_CONVERSION);
+
+	cvtColor(img, converted, COLOR_BGR2YCrCb);
+
+	for (int c = 0; c < COMPONENTS; c++) {
+		planes[c].create(img.rows, img.cols);
+	}
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				planes[c](i, j) = converted(i, j)[c];
+			}
+		}
+	}
+
+	if (subsampling) {
+		for (int c = 1; c < COMPONENTS; c++) {
+			Mat_<uchar> reduced = chromaticDownsampling(planes[c]);
+
+			for (int i = 0; i < img.rows; i++) {
+				for (int j = 0; j < img.cols; j++) {
+					planes[c](i, j) = reduced(i / 2, j / 2);
+				}
+			}
+		}
+	}
+}
+
+// a zero block codes nothing but zeros, a flat one its DC followed by zeros
+void countBlockKind(const rleElement* code, int len) {
+	bool zeroAC = true;
+
+	for (int i = 1; i < len - 1; i++) {
+		zeroAC = zeroAC && code[i].val == 0;
+	}
+
+	PROFILE_COUNT(COUNTER_ZERO_BLOCKS, zeroAC && code[0].val == 0);
+	PROFILE_COUNT(COUNTER_FLAT_BLOCKS, zeroAC && code[0].val != 0 && code[0].count == 1);
+}
+
+template <int N>
+void appendBlockColumnOf(Mat_<uchar>* planes, int x, int quality, blockCache* cache, vector<uint8_t>& out) {
+	uchar q[N * N];
+	uchar samples[N * N];
+	rleElement code[N * N + 1];
+
+	scaledQuantizationTable<N>(quality, q);
+
+	for (int y = 0; y < getNumberOfBlocksY(planes[0], N); y++) {
+		for (int c = 0; c < COMPONENTS; c++) {
+			getBlockSamples<N>(planes[c], x, y, samples);
+
+			int len = 0;
+
+			if (N == 8 && cache != NULL) {
+				rleElement* rleEl = encodeBlockCached(cache, Mat_<uchar>(8, 8, samples), &len, quality);
+				memcpy(code, rleEl, len * sizeof(rleElement));
+				free(rleEl);
+			}
+			else {
+				len = encodeBlockSamples<N>(samples, q, code);
+			}
+
+			uint8_t* bytes = (uint8_t*)code;
+			out.insert(out.end(), bytes, bytes + len * sizeof(rleElement));
+
+			PROFILE_COUNT(COUNTER_BLOCKS_ENCODED, 1);
+			PROFILE_COUNT((profileCounter)(COUNTER_BYTES_Y + c), len * sizeof(rleElement));
+
+			if (PROFILE_ENABLED()) {
+				countBlockKind(code, len);
+			}
+		}
+	}
+}
+
+void appendBlockColumn(Mat_<uchar>* planes, int x, int quality, blockCache* cache, vector<uint8_t>& out, int blockSize) {
+	switch (blockSize) {
+	case 4:
+		appendBlockColumnOf<4>(planes, x, quality, cache, out);
+		break;
+	case 16:
+		appendBlockColumnOf<16>(planes, x, quality, cache, out);
+		break;
+	default:
+		appendBlockColumnOf<8>(planes, x, quality, cache, out);
+		break;
+	}
+}
+
+Encoder::Encoder(int quality, blockCache* cache) {
+	this->quality = quality;
+	this->subsampling = false;
+	this->blockSize = DEFAULT_BLOCK_SIZE;
+	this->cache = cache;
+}
+
+void Encoder::setQuality(int quality) {
+	this->quality = quality;
+}
+
+int Encoder::getQuality() const {
+	return quality;
+}
+
+void Encoder::setCache(blockCache* cache) {
+	this->cache = cache;
+}
+
+void Encoder::setSubsampling(bool subsampling) {
+	this->subsampling = subsampling;
+}
+
+bool Encoder::getSubsampling() const {
+	return subsampling;
+}
+
+bool Encoder::setBlockSize(int blockSize) {
+	if (!isSupportedBlockSize(blockSize)) {
+		return false;
+	}
+
+	this->blockSize = blockSize;
+
+	return true;
+}
+
+int Encoder::getBlockSize() const {
+	return blockSize;
+}
+
+size_t Encoder::encode(const Mat_<Vec3b>& img, vector<uint8_t>& out) {
+	size_t start = out.size();
+
+	splitComponents(img, converted, planes, subsampling);
+
+	for (int x = 0; x < getNumberOfBlocksX(img, blockSize); x++) {
+		appendBlockColumn(planes, x, quality, cache, out, blockSize);
+	}
+
+	return out.size() - start;
+}
+
+size_t Encoder::encode(const Mat_<Vec3b>& img, uint8_t* buffer, size_t capacity, size_t* required) {
+	scratch.clear();
+
+	size_t length = encode(img, scratch);
+
+	if (required != NULL) {
+		*required = length;
+	}
+
+	if (length > capacity) {
+		return 0;
+	}
+
+	memcpy(buffer, scratch.data(), length);
+
+	return length;
+}
+
+size_t Encoder::encodeContainer(const Mat_<Vec3b>& img, vector<uint8_t>& out) {
+	appendContainerHeader(out, img.cols, img.rows, quality, blockSize);
+
+	return sizeof(containerHeader) + encode(img, out);
+}
+
+Decoder::Decoder(int quality) {
+	this->quality = quality;
+	this->blockSize = DEFAULT_BLOCK_SIZE;
+}
+
+void Decoder::setQuality(int quality) {
+	this->quality = quality;
+}
+
+int Decoder::getQuality() const {
+	return quality;
+}
+
+bool Decoder::setBlockSize(int blockSize) {
+	if (!isSupportedBlockSize(blockSize)) {
+		return false;
+	}
+
+	this->blockSize = blockSize;
+
+	return true;
+}
+
+int Decoder::getBlockSize() const {
+	return blockSize;
+}
+
+template <int N>
+bool decodeBlockGrid(const uint8_t* data, size_t size, int sizeX, int sizeY, int quality, Mat_<Vec3b>& decompressed) {
+	const rleElement* code = (const rleElement*)data;
+	size_t count = size / sizeof(rleElement);
+	size_t pos = 0;
+
+	uchar q[N * N];
+	uchar samples[N * N];
+
+	scaledQuantizationTable<N>(quality, q);
+
+	bool complete = true;
+
+	decompressed.create(N * sizeY, N * sizeX);
+
+	for (int x = 0; x < sizeX; x++) {
+		for (int y = 0; y < sizeY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				size_t end = pos;
+
+				while (end < count && !(code[end].val == EOB.val && code[end].count == EOB.count)) {
+					end++;
+				}
+
+				if (end >= count) {
+					complete = false;
+				}
+
+				if (!complete) {
+					// blocks missing from a truncated stream are left black
+					for (int i = 0; i < N; i++) {
+						for (int j = 0; j < N; j++) {
+							decompressed(N * y + i, N * x + j)[c] = c == 0 ? 0 : 128;
+						}
+					}
+
+					continue;
+				}
+
+				decodeBlockCode<N>(code + pos, q, samples);
+
+				PROFILE_COUNT(COUNTER_BLOCKS_DECODED, 1);
+				PROFILE_SCOPE(ZONE_STORE_BLOCK);
+
+				for (int i = 0; i < N; i++) {
+					for (int j = 0; j < N; j++) {
+						decompressed(N * y + i, N * x + j)[c] = samples[N * i + j];
+					}
+				}
+
+				pos = end + 1;
+			}
+		}
+	}
+
+	return complete;
+}
+
+bool Decoder::decode(const uint8_t* data, size_t size, int sizeX, int sizeY, Mat_<Vec3b>& out) {
+	bool complete;
+
+	switch (blockSize) {
+	case 4:
+		complete = decodeBlockGrid<4>(data, size, sizeX, sizeY, quality, decompressed);
+		break;
+	case 16:
+		complete = decodeBlockGrid<16>(data, size, sizeX, sizeY, quality, decompressed);
+		break;
+	default:
+		complete = decodeBlockGrid<8>(data, size, sizeX, sizeY, quality, decompressed);
+		break;
+	}
+
+	PROFILE_SCOPE(ZONE_INVERSE_COLOR_CONVERSION);
+
+	cvtColor(decompressed, out, COLOR_YCrCb2BGR);
+
+	return complete;
+}
+
+bool Decoder::decodeContainer(const uint8_t* data, size_t size, Mat_<Vec3b>& out) {
+	containerHeader header;
+
+	size_t headerLength = readContainerHeader(data, size, &header);
+
+	if (headerLength == 0) {
+		return false;
+	}
+
+	int sizeX = (header.width + header.blockSize - 1) / header.blockSize;
+	int sizeY = (header.height + header.blockSize - 1) / header.blockSize;
+
+	int previousQuality = quality;
+	int previousBlockSize = blockSize;
+	quality = header.quality;
+	blockSize = header.blockSize;
+
+	bool complete = decode(data + headerLength, size - headerLength, sizeX, sizeY, padded);
+
+	quality = previousQuality;
+	blockSize = previousBlockSize;
+
+	padded(Rect(0, 0, header.width, header.height)).copyTo(out);
+
+	return complete;
+}
+
+// *************************************************************************************************
+//							Progressive Compression
+// *************************************************************************************************
+
+// DC first, then the low and high AC bands at reduced precision, then the refinement bits
+scanDescriptor defaultScanScript[] = {
+	{ 0,  0, 1, 0 },
+	{ 1,  5, 2, 0 },
+	{ 6, 63, 2, 0 },
+	{ 1, 63, 1, 1 },
+	{ 0,  0, 0, 1 },
+	{ 1, 63, 0, 1 }
+};
+
+coefficientBuffer allocateCoefficientBuffer(int blocksX, int blocksY) {
+	coefficientBuffer buffer;
+
+	buffer.blocksX = blocksX;
+	buffer.blocksY = blocksY;
+	buffer.values = (char*)calloc(blocksX * blocksY * COMPONENTS * COEFFICIENTS_PER_BLOCK, sizeof(char));
+
+	return buffer;
+}
+
+char* coefficientsAt(coefficientBuffer* buffer, int x, int y, int component) {
+	return buffer->values + ((x * buffer->blocksY + y) * COMPONENTS + component) * COEFFICIENTS_PER_BLOCK;
+}
+
+coefficientBuffer bufferQuantizedCoefficients(Mat_<Vec3b> img, int quality) {
+	Mat_<Vec3b> cvt(img.rows, img.cols);
+
+	cvtColor(img, cvt, COLOR_BGR2YCrCb);
+
+	Mat_<uchar> components[COMPONENTS] = { getLuminance(cvt), getRedChromatics(cvt), getBlueChromatics(cvt) };
+
+	coefficientBuffer buffer = allocateCoefficientBuffer(getNumberOfBlocksX(img, 8), getNumberOfBlocksY(img, 8));
+
+	for (int x = 0; x < buffer.blocksX; x++) {
+		for (int y = 0; y < buffer.blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				Mat_<uchar> block = get8x8BlockAt(x, y, components[c]);
+
+				Mat_<char> quantizedBlock = quantization(discreteCosineTransform(convertToSigned(block)), quality);
+
+				char* vals = zigZagTraversal(quantizedBlock);
+
+				memcpy(coefficientsAt(&buffer, x, y, c), vals, COEFFICIENTS_PER_BLOCK);
+
+				free(vals);
+			}
+		}
+	}
+
+	return buffer;
+}
+
+char scanValue(char coefficient, scanDescriptor scan) {
+	int magnitude = abs(coefficient) >> scan.shift;
+
+	if (scan.refinement) {
+		magnitude &= 1;
+	}
+
+	return (char)(coefficient < 0 ? -magnitude : magnitude);
+}
+
+void applyScanValue(char* coefficient, char value, scanDescriptor scan) {
+	// a first scan finds the coefficient still at 0, so the same rule covers both kinds of scans
+	int magnitude = abs(*coefficient) | (abs(value) << scan.shift);
+	bool negative = *coefficient != 0 ? *coefficient < 0 : value < 0;
+
+	*coefficient = (char)(negative ? -magnitude : magnitude);
+}
+
+// The bands of all the blocks are coded as one sequence of runs, without an EOB per block: the zeros that
+// end one block run on into the next, so a stretch of empty blocks costs a few elements instead of one each.
+// A refinement scan first packs the bits of the coefficients the decoder already has as nonzero, 16 to an
+// element, as those bits are about as often 1 as 0 and have a known sign; only the rest are run coded.
+// sent mirrors the coefficients the decoder holds after the previous scans and is brought up to date.
+rleElement* encodeScan(coefficientBuffer* coefficients, coefficientBuffer* sent, scanDescriptor scan, int* scanLength) {
+	int bandLength = scan.end - scan.start + 1;
+	int blocks = coefficients->blocksX * coefficients->blocksY * COMPONENTS;
+
+	vector<uint8_t> bits;
+	int bitCount = 0;
+	rleElement* runs = (rleElement*)calloc(maxInt(blocks * bandLength, 1), sizeof(rleElement));
+	int n = 0;
+
+	for (int x = 0; x < coefficients->blocksX; x++) {
+		for (int y = 0; y < coefficients->blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				char* vals = coefficientsAt(coefficients, x, y, c);
+				char* known = coefficientsAt(sent, x, y, c);
+
+				for (int k = scan.start; k <= scan.end; k++) {
+					char value = scanValue(vals[k], scan);
+
+					if (scan.refinement && known[k] != 0) {
+						if (bitCount % 8 == 0) {
+							bits.push_back(0);
+						}
+
+						bits.back() |= (uint8_t)((value != 0) << (bitCount % 8));
+						bitCount++;
+					}
+					else if (n > 0 && runs[n - 1].val == value && runs[n - 1].count < 255) {
+						runs[n - 1].count++;
+					}
+					else {
+						runs[n].val = value;
+						runs[n].count = 1;
+						n++;
+					}
+
+					applyScanValue(&known[k], value, scan);
+				}
+			}
+		}
+	}
+
+	bits.resize((bits.size() + 1) / 2 * sizeof(rleElement), 0);
+
+	int packed = (int)(bits.size() / sizeof(rleElement));
+	rleElement* encoded = (rleElement*)malloc(maxInt(packed + n, 1) * sizeof(rleElement));
+
+	if (!bits.empty()) {
+		memcpy(encoded, bits.data(), bits.size());
+	}
+
+	memcpy(encoded + packed, runs, n * sizeof(rleElement));
+
+	free(runs);
+
+	*scanLength = packed + n;
+
+	return encoded;
+}
+
+void compressProgressiveImage(Mat_<Vec3b> img, const char* filename, int quality, scanDescriptor* script, int scriptLength) {
+	FILE* pf = fopen(filename, "wb");
+
+	if (pf == NULL) {
+		puts("Error opening the file...");
+		return;
+	}
+
+	// the quality the tables are actually scaled with, so the decoder scales them the same way
+	progressiveHeader fileHeader;
+
+	memcpy(fileHeader.magic, PROGRESSIVE_MAGIC, sizeof(fileHeader.magic));
+	fileHeader.width = img.cols;
+	fileHeader.height = img.rows;
+	fileHeader.quality = effectiveQuality(quality);
+
+	fwrite(&fileHeader, sizeof(progressiveHeader), 1, pf);
+
+	coefficientBuffer coefficients = bufferQuantizedCoefficients(img, fileHeader.quality);
+	coefficientBuffer sent = allocateCoefficientBuffer(coefficients.blocksX, coefficients.blocksY);
+
+	for (int s = 0; s < scriptLength; s++) {
+		int len = 0;
+		rleElement* encoded = encodeScan(&coefficients, &sent, script[s], &len);
+
+		scanHeader header = { script[s], len };
+
+		fwrite(&header, sizeof(scanHeader), 1, pf);
+		fwrite(encoded, sizeof(rleElement), len, pf);
+
+		free(encoded);
+	}
+
+	fclose(pf);
+
+	free(coefficients.values);
+	free(sent.values);
+}
+
+int decodeScans(uchar* stream, int available, coefficientBuffer* coefficients) {
+	int offset = 0;
+	int scans = 0;
+
+	while (offset + (int)sizeof(scanHeader) <= available) {
+		scanHeader header;
+		memcpy(&header, stream + offset, sizeof(scanHeader));
+
+		if (header.scan.start > header.scan.end || header.scan.end >= COEFFICIENTS_PER_BLOCK || header.length < 0) {
+			puts("Corrupted progressive stream...");
+			break;
+		}
+
+		int bandLength = header.scan.end - header.scan.start + 1;
+		size_t blocks = (size_t)coefficients->blocksX * coefficients->blocksY * COMPONENTS;
+
+		// every run holds at least one value of the bands, and the packed bits one per value at most
+		if ((size_t)header.length > blocks * bandLength + (blocks * bandLength + 15) / 16) {
+			puts("Corrupted progressive stream...");
+			break;
+		}
+
+		// scans that have not arrived completely are left for the next call
+		size_t remaining = (size_t)(available - offset) - sizeof(scanHeader);
+
+		if ((size_t)header.length > remaining / sizeof(rleElement)) {
+			break;
+		}
+
+		size_t scanBytes = (size_t)header.length * sizeof(rleElement);
+		rleElement* code = (rleElement*)(stream + offset + sizeof(scanHeader));
+		const uchar* bits = (const uchar*)code;
+		size_t bitCount = 0;
+
+		// the packed bits of a refinement scan are those of the coefficients that are already nonzero
+		if (header.scan.refinement) {
+			for (size_t k = 0; k < blocks * COEFFICIENTS_PER_BLOCK; k++) {
+				int index = (int)(k % COEFFICIENTS_PER_BLOCK);
+
+				bitCount += index >= header.scan.start && index <= header.scan.end && coefficients->values[k] != 0;
+			}
+		}
+
+		int packed = (int)((bitCount + 15) / 16);
+
+		if (packed > header.length) {
+			puts("Corrupted progressive stream...");
+			break;
+		}
+
+		int bit = 0;
+		int pos = packed;
+		int left = 0;
+		char value = 0;
+
+		for (int x = 0; x < coefficients->blocksX; x++) {
+			for (int y = 0; y < coefficients->blocksY; y++) {
+				for (int c = 0; c < COMPONENTS; c++) {
+					char* vals = coefficientsAt(coefficients, x, y, c);
+
+					for (int i = 0; i < bandLength; i++) {
+						if (header.scan.refinement && vals[header.scan.start + i] != 0) {
+							applyScanValue(&vals[header.scan.start + i], (bits[bit / 8] >> (bit % 8)) & 1, header.scan);
+							bit++;
+							continue;
+						}
+
+						if (left == 0) {
+							// the runs have to cover every value of the bands, with none of count 0
+							if (pos == header.length || code[pos].count == 0) {
+								puts("Corrupted progressive stream...");
+								return scans;
+							}
+
+							value = code[pos].val;
+							left = code[pos].count;
+							pos++;
+						}
+
+						applyScanValue(&vals[header.scan.start + i], value, header.scan);
+						left--;
+					}
+				}
+			}
+		}
+
+		offset += (int)(sizeof(scanHeader) + scanBytes);
+		scans++;
+	}
+
+	return scans;
+}
+
+Mat_<Vec3b> renderCoefficients(coefficientBuffer* coefficients, int quality) {
+	Mat_<Vec3b> decompressed(8 * coefficients->blocksY, 8 * coefficients->blocksX);
+
+	for (int x = 0; x < coefficients->blocksX; x++) {
+		for (int y = 0; y < coefficients->blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				Mat_<uchar> block = decompressZigZagBlock(coefficientsAt(coefficients, x, y, c), quality);
+
+				for (int i = 0; i < 8; i++) {
+					for (int j = 0; j < 8; j++) {
+						decompressed(8 * y + j, 8 * x + i)[c] = block(j, i);
+					}
+				}
+			}
+		}
+	}
+
+	Mat_<Vec3b> result(8 * coefficients->blocksY, 8 * coefficients->blocksX);
+
+	cvtColor(decompressed, result, COLOR_YCrCb2BGR);
+
+	return result;
+}
+
+size_t readProgressiveHeader(const uint8_t* data, size_t size, progressiveHeader* header) {
+	if (size < sizeof(progressiveHeader) || memcmp(data, PROGRESSIVE_MAGIC, sizeof(header->magic)) != 0) {
+		return 0;
+	}
+
+	memcpy(header, data, sizeof(progressiveHeader));
+
+	if (header->width <= 0 || header->height <= 0 || (long long)header->width * header->height > MAX_CONTAINER_PIXELS
+		|| header->quality < 1 || header->quality > maxQuality()) {
+		return 0;
+	}
+
+	return sizeof(progressiveHeader);
+}
+
+Mat_<Vec3b> decompressProgressiveImage(uchar* stream, int available, int* scansDecoded) {
+	progressiveHeader header;
+
+	if (scansDecoded != NULL) {
+		*scansDecoded = 0;
+	}
+
+	if (available < 0 || readProgressiveHeader(stream, available, &header) == 0) {
+		return Mat_<Vec3b>();
+	}
+
+	coefficientBuffer coefficients = allocateCoefficientBuffer((header.width + 7) / 8, (header.height + 7) / 8);
+
+	int scans = decodeScans(stream + sizeof(progressiveHeader), available - (int)sizeof(progressiveHeader), &coefficients);
+
+	if (scansDecoded != NULL) {
+		*scansDecoded = scans;
+	}
+
+	Mat_<Vec3b> result = renderCoefficients(&coefficients, header.quality)(Rect(0, 0, header.width, header.height)).clone();
+
+	free(coefficients.values);
+
+	return result;
+}
+
+Mat_<Vec3b> decompressProgressiveImage(const char* filename, int availableBytes) {
+	FILE* pf = fopen(filename, "rb");
+
+	if (!pf) {
+		puts("Error opening the file...");
+		return Mat_<Vec3b>();
+	}
+
+	fseek(pf, 0, SEEK_END);
+	int available = minInt((int)ftell(pf), availableBytes);
+	fseek(pf, 0, SEEK_SET);
+
+	uchar* stream = (uchar*)malloc(maxInt(available, 1));
+	available = (int)fread(stream, 1, available, pf);
+
+	fclose(pf);
+
+	Mat_<Vec3b> result = decompressProgressiveImage(stream, available, NULL);
+
+	free(stream);
+
+	return result;
+}
+
+// *************************************************************************************************
+//							Rate Control
+// *************************************************************************************************
+
+void getZigZagOrder(int* order) {
+	Mat_<char> indices(8, 8);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			indices(i, j) = (char)(8 * i + j);
+		}
+	}
+
+	char* vals = zigZagTraversal(indices);
+
+	for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+		order[k] = vals[k];
+	}
+
+	free(vals);
+}
+
+// Colour conversion and forward DCT are done once; the planes keep the unquantized coefficients
+transformedImage transformImage(Mat_<Vec3b> img) {
+	Mat_<Vec3b> cvt(img.rows, img.cols);
+
+	cvtColor(img, cvt, COLOR_BGR2YCrCb);
+
+	Mat_<uchar> components[COMPONENTS] = { getLuminance(cvt), getRedChromatics(cvt), getBlueChromatics(cvt) };
+
+	transformedImage t;
+	t.blocksX = getNumberOfBlocksX(img, 8);
+	t.blocksY = getNumberOfBlocksY(img, 8);
+
+	for (int c = 0; c < COMPONENTS; c++) {
+		t.planes[c] = Mat_<float>(8 * t.blocksY, 8 * t.blocksX);
+	}
+
+	for (int x = 0; x < t.blocksX; x++) {
+		for (int y = 0; y < t.blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				Mat_<float> transformedBlock = discreteCosineTransform(convertToSigned(get8x8BlockAt(x, y, components[c])));
+
+				for (int i = 0; i < 8; i++) {
+					for (int j = 0; j < 8; j++) {
+						t.planes[c](8 * y + i, 8 * x + j) = transformedBlock(i, j);
+					}
+				}
+			}
+		}
+	}
+
+	return t;
+}
+
+void quantizeTransformedBlock(transformedImage* t, int x, int y, int component, Mat_<uchar> q, int* order, char* vals) {
+	for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+		int i = order[k] / 8;
+		int j = order[k] % 8;
+
+		vals[k] = quantizeCoefficient(t->planes[component](8 * y + i, 8 * x + j), q(i, j));
+	}
+}
+
+// Exact size of the stream compressImage would write, without building the run-length codes
+int estimateCompressedSize(transformedImage* t, int quality) {
+	Mat_<uchar> q = quantizationTable(quality);
+
+	int order[COEFFICIENTS_PER_BLOCK];
+	getZigZagOrder(order);
+
+	char vals[COEFFICIENTS_PER_BLOCK];
+	int elements = 0;
+
+	for (int x = 0; x < t->blocksX; x++) {
+		for (int y = 0; y < t->blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				quantizeTransformedBlock(t, x, y, c, q, order, vals);
+
+				// the first run and the EOB
+				elements += 2;
+
+				for (int k = 1; k < COEFFICIENTS_PER_BLOCK; k++) {
+					if (vals[k] != vals[k - 1]) {
+						elements++;
+					}
+				}
+			}
+		}
+	}
+
+	return elements * sizeof(rleElement);
+}
+
+void writeTransformedImage(transformedImage* t, int quality, const char* filename) {
+	FILE* pf = fopen(filename, "wb");
+
+	if (pf == NULL) {
+		puts("Error opening the file...");
+		return;
+	}
+
+	Mat_<uchar> q = quantizationTable(quality);
+
+	int order[COEFFICIENTS_PER_BLOCK];
+	getZigZagOrder(order);
+
+	char vals[COEFFICIENTS_PER_BLOCK];
+
+	for (int x = 0; x < t->blocksX; x++) {
+		for (int y = 0; y < t->blocksY; y++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				quantizeTransformedBlock(t, x, y, c, q, order, vals);
+
+				int len = 0;
+				rleElement* rleEl = rle(vals, COEFFICIENTS_PER_BLOCK, &len);
+
+				fwrite(rleEl, sizeof(rleElement), len, pf);
+
+				free(rleEl);
+			}
+		}
+	}
+
+	fclose(pf);
+}
+
+// Writes the image at the highest quality whose stream fits in maxBytes and returns that quality,
+// which has to be passed to decompressImage
+int compressImageToSize(Mat_<Vec3b> img, const char* filename, int maxBytes) {
+	transformedImage t = transformImage(img);
+
+	// qualities above maxQuality() code the same stream as it, so the search stops there
+	int low = 1;
+	int high = maxQuality();
+	int best = 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+
+		if (estimateCompressedSize(&t, mid) <= maxBytes) {
+			best = mid;
+			low = mid + 1;
+		}
+		else {
+			high = mid - 1;
+		}
+	}
+
+	if (best == 1 && estimateCompressedSize(&t, best) > maxBytes) {
+		puts("The target size cannot be reached, using the lowest quality...");
+	}
+
+	writeTransformedImage(&t, best, filename);
+
+	return best;
+}
+
+// *************************************************************************************************
+//							Transcoding
+// *************************************************************************************************
+
+// Moves the quantized coefficients of a compressed file to the table of another quality and
+// re-encodes them; no inverse or forward DCT and no colour conversion are involved
+bool transcodeImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, int oldQuality, int newQuality) {
+	FILE* in = fopen(inputFilename, "rb");
+
+	if (in == NULL) {
+		puts("Error opening the file...");
+		return false;
+	}
+
+	FILE* out = fopen(outputFilename, "wb");
+
+	if (out == NULL) {
+		puts("Error opening the file...");
+		fclose(in);
+		return false;
+	}
+
+	Mat_<uchar> oldQ = quantizationTable(oldQuality);
+	Mat_<uchar> newQ = quantizationTable(newQuality);
+
+	int order[COEFFICIENTS_PER_BLOCK];
+	getZigZagOrder(order);
+
+	uchar oldValues[COEFFICIENTS_PER_BLOCK];
+	uchar newValues[COEFFICIENTS_PER_BLOCK];
+
+	for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+		oldValues[k] = oldQ(order[k] / 8, order[k] % 8);
+		newValues[k] = newQ(order[k] / 8, order[k] % 8);
+	}
+
+	bool complete = true;
+
+	for (int b = 0; b < sizeX * sizeY * COMPONENTS && complete; b++) {
+		rleElement* code = readBlock(in, &complete);
+
+		if (!complete) {
+			free(code);
+			break;
+		}
+
+		char* vals = rleDecode(code);
+
+		for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+			vals[k] = quantizeCoefficient((float)vals[k] * oldValues[k], newValues[k]);
+		}
+
+		int len = 0;
+		rleElement* rleEl = rle(vals, COEFFICIENTS_PER_BLOCK, &len);
+
+		fwrite(rleEl, sizeof(rleElement), len, out);
+
+		free(rleEl);
+		free(vals);
+		free(code);
+	}
+
+	if (!complete) {
+		puts("The compressed file is incomplete...");
+	}
+
+	fclose(in);
+
+	return fclose(out) == 0 && complete;
+}
+
+// *************************************************************************************************
+//							Lossless Transformations
+// *************************************************************************************************
+
+// The block order of a compressed file is the layout of a coefficient buffer
+coefficientBuffer readCoefficients(const char* filename, int sizeX, int sizeY) {
+	coefficientBuffer coefficients = allocateCoefficientBuffer(sizeX, sizeY);
+
+	FILE* pf = fopen(filename, "rb");
+
+	if (pf == NULL) {
+		puts("Error opening the file...");
+		return coefficients;
+	}
+
+	for (int b = 0; b < sizeX * sizeY * COMPONENTS; b++) {
+		rleElement* code = readBlock(pf);
+		char* vals = rleDecode(code);
+
+		memcpy(coefficients.values + b * COEFFICIENTS_PER_BLOCK, vals, COEFFICIENTS_PER_BLOCK);
+
+		free(vals);
+		free(code);
+	}
+
+	fclose(pf);
+
+	return coefficients;
+}
+
+void writeCoefficients(coefficientBuffer* coefficients, const char* filename) {
+	FILE* pf = fopen(filename, "wb");
+
+	if (pf == NULL) {
+		puts("Error opening the file...");
+		return;
+	}
+
+	for (int b = 0; b < coefficients->blocksX * coefficients->blocksY * COMPONENTS; b++) {
+		int len = 0;
+		rleElement* rleEl = rle(coefficients->values + b * COEFFICIENTS_PER_BLOCK, COEFFICIENTS_PER_BLOCK, &len);
+
+		fwrite(rleEl, sizeof(rleElement), len, pf);
+
+		free(rleEl);
+	}
+
+	fclose(pf);
+}
+
+char negateCoefficient(char value) {
+	return (char)minInt(-value, 127);
+}
+
+// Transposes the image (optionally), then mirrors it horizontally and/or vertically. Mirroring a block
+// negates its odd horizontal or vertical frequencies; the block grid itself is permuted the same way.
+// The quantization table is not symmetric and the stream does not carry it, so a transposed coefficient
+// is moved to the step of its new position; mirroring alone is exact.
+coefficientBuffer transformCoefficients(coefficientBuffer* src, bool transpose, bool flipX, bool flipY, int quality) {
+	int blocksX = transpose ? src->blocksY : src->blocksX;
+	int blocksY = transpose ? src->blocksX : src->blocksY;
+
+	coefficientBuffer dst = allocateCoefficientBuffer(blocksX, blocksY);
+
+	int order[COEFFICIENTS_PER_BLOCK];
+	getZigZagOrder(order);
+
+	int position[COEFFICIENTS_PER_BLOCK];
+
+	for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+		position[order[k]] = k;
+	}
+
+	Mat_<uchar> q = quantizationTable(quality);
+
+	int source[COEFFICIENTS_PER_BLOCK];
+	bool negate[COEFFICIENTS_PER_BLOCK];
+	bool requantize[COEFFICIENTS_PER_BLOCK];
+	uchar srcQ[COEFFICIENTS_PER_BLOCK];
+	uchar dstQ[COEFFICIENTS_PER_BLOCK];
+
+	for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+		int i = order[k] / 8;
+		int j = order[k] % 8;
+
+		source[k] = transpose ? position[8 * j + i] : k;
+		negate[k] = ((flipX && j % 2 == 1) != (flipY && i % 2 == 1));
+
+		srcQ[k] = transpose ? q(j, i) : q(i, j);
+		dstQ[k] = q(i, j);
+		requantize[k] = srcQ[k] != dstQ[k];
+	}
+
+	for (int x = 0; x < blocksX; x++) {
+		for (int y = 0; y < blocksY; y++) {
+			int tx = flipX ? blocksX - 1 - x : x;
+			int ty = flipY ? blocksY - 1 - y : y;
+
+			int srcX = transpose ? ty : tx;
+			int srcY = transpose ? tx : ty;
+
+			for (int c = 0; c < COMPONENTS; c++) {
+				char* srcVals = coefficientsAt(src, srcX, srcY, c);
+				char* dstVals = coefficientsAt(&dst, x, y, c);
+
+				for (int k = 0; k < COEFFICIENTS_PER_BLOCK; k++) {
+					char value = srcVals[source[k]];
+
+					if (requantize[k]) {
+						value = quantizeCoefficient((float)value * srcQ[k], dstQ[k]);
+					}
+
+					dstVals[k] = negate[k] ? negateCoefficient(value) : value;
+				}
+			}
+		}
+	}
+
+	return dst;
+}
+
+coefficientBuffer transformCoefficients(coefficientBuffer* src, blockTransform transform, int quality) {
+	switch (transform) {
+		case FLIP_HORIZONTAL:
+			return transformCoefficients(src, false, true, false, quality);
+		case FLIP_VERTICAL:
+			return transformCoefficients(src, false, false, true, quality);
+		case TRANSPOSE:
+			return transformCoefficients(src, true, false, false, quality);
+		case TRANSVERSE:
+			return transformCoefficients(src, true, true, true, quality);
+		case ROTATE_90:
+			return transformCoefficients(src, true, true, false, quality);
+		case ROTATE_180:
+			return transformCoefficients(src, false, true, true, quality);
+		case ROTATE_270:
+			return transformCoefficients(src, true, false, true, quality);
+		default:
+			return transformCoefficients(src, false, false, false, quality);
+	}
+}
+
+// Orientation values 1-8 of the EXIF tag, as the transform that displays the image upright
+blockTransform exifOrientationTransform(int orientation) {
+	blockTransform transforms[] = { TRANSFORM_NONE, FLIP_HORIZONTAL, ROTATE_180, FLIP_VERTICAL, TRANSPOSE, ROTATE_90, TRANSVERSE, ROTATE_270 };
+
+	if (orientation < 1 || orientation > 8) {
+		return TRANSFORM_NONE;
+	}
+
+	return transforms[orientation - 1];
+}
+
+coefficientBuffer cropCoefficients(coefficientBuffer* src, int x, int y, int width, int height) {
+	x = minInt(maxInt(x, 0), src->blocksX);
+	y = minInt(maxInt(y, 0), src->blocksY);
+	width = minInt(maxInt(width, 0), src->blocksX - x);
+	height = minInt(maxInt(height, 0), src->blocksY - y);
+
+	coefficientBuffer dst = allocateCoefficientBuffer(width, height);
+
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			memcpy(coefficientsAt(&dst, i, j, 0), coefficientsAt(src, x + i, y + j, 0), COMPONENTS * COEFFICIENTS_PER_BLOCK);
+		}
+	}
+
+	return dst;
+}
+
+// The transformations work on the whole block grid, so the padding of partial edge blocks moves along
+// with them. Transposing and the 90/270 degree rotations swap the number of blocks on the two axes.
+void transformCompressedImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, blockTransform transform, int quality) {
+	coefficientBuffer coefficients = readCoefficients(inputFilename, sizeX, sizeY);
+	coefficientBuffer transformed = transformCoefficients(&coefficients, transform, quality);
+
+	writeCoefficients(&transformed, outputFilename);
+
+	free(coefficients.values);
+	free(transformed.values);
+}
+
+// Position and size of the crop are given in blocks
+void cropCompressedImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, int x, int y, int width, int height) {
+	coefficientBuffer coefficients = readCoefficients(inputFilename, sizeX, sizeY);
+	coefficientBuffer cropped = cropCoefficients(&coefficients, x, y, width, height);
+
+	writeCoefficients(&cropped, outputFilename);
+
+	free(coefficients.values);
+	free(cropped.values);
+}
+
+// *************************************************************************************************
+//							Frame Sequences
+// *************************************************************************************************
+
+// A block position that did not change since the previous frame; no real block starts with a run of length 0
+rleElement SKIP = { (char)0, (uchar)0 };
+
+Mat_<Vec3b> getBGRBlockAt(int x, int y, Mat_<Vec3b> img) {
+	Mat_<Vec3b> block(8, 8);
+
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			if (isInside(img, 8 * y + i, 8 * x + j)) {
+				block(i, j) = img(8 * y + i, 8 * x + j);
+			}
+			else {
+				block(i, j) = Vec3b(0, 0, 0);
+			}
+		}
+	}
+
+	return block;
+}
+
+bool blockChanged(Mat_<Vec3b> previous, Mat_<Vec3b> current, int x, int y) {
+	int width = minInt(8, current.cols - 8 * x);
+
+	for (int i = 8 * y; i < minInt(8 * y + 8, current.rows); i++) {
+		if (memcmp(&previous(i, 8 * x), &current(i, 8 * x), width * sizeof(Vec3b)) != 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+sequenceEncoder openSequenceEncoder(const char* filename, int width, int height, int quality) {
+	sequenceEncoder encoder;
+
+	memcpy(encoder.header.magic, SEQUENCE_MAGIC, sizeof(encoder.header.magic));
+	encoder.header.width = width;
+	encoder.header.height = height;
+	encoder.header.quality = effectiveQuality(quality);
+	encoder.blocksX = (width + 7) / 8;
+	encoder.blocksY = (height + 7) / 8;
+	encoder.first = true;
+
+	encoder.pf = fopen(filename, "wb");
+
+	if (encoder.pf == NULL) {
+		puts("Error opening the file...");
+		return encoder;
+	}
+
+	fwrite(&encoder.header, sizeof(sequenceHeader), 1, encoder.pf);
+
+	return encoder;
+}
+
+// Codes the blocks that differ from the previous frame and returns how many there were
+int encodeFrame(sequenceEncoder* encoder, Mat_<Vec3b> frame) {
+	if (encoder->pf == NULL || frame.rows != encoder->header.height || frame.cols != encoder->header.width) {
+		puts("The frame does not match the sequence...");
+		return 0;
+	}
+
+	int changed = 0;
+
+	for (int x = 0; x < encoder->blocksX; x++) {
+		for (int y = 0; y < encoder->blocksY; y++) {
+			if (!encoder->first && !blockChanged(encoder->previous, frame, x, y)) {
+				fwrite(&SKIP, sizeof(rleElement), 1, encoder->pf);
+				continue;
+			}
+
+			Mat_<Vec3b> block = getBGRBlockAt(x, y, frame);
+			Mat_<Vec3b> cvt(8, 8);
+
+			cvtColor(block, cvt, COLOR_BGR2YCrCb);
+
+			Mat_<uchar> components[COMPONENTS] = { getLuminance(cvt), getRedChromatics(cvt), getBlueChromatics(cvt) };
+
+			for (int c = 0; c < COMPONENTS; c++) {
+				int len = 0;
+				rleElement* rleEl = encodeBlock(components[c], &len, encoder->header.quality);
+
+				fwrite(rleEl, sizeof(rleElement), len, encoder->pf);
+
+				free(rleEl);
+			}
+
+			changed++;
+		}
+	}
+
+	encoder->previous = frame.clone();
+	encoder->first = false;
+
+	return changed;
+}
+
+void closeSequenceEncoder(sequenceEncoder* encoder) {
+	if (encoder->pf != NULL) {
+		fclose(encoder->pf);
+		encoder->pf = NULL;
+	}
+}
+
+sequenceDecoder openSequenceDecoder(const char* filename) {
+	sequenceDecoder decoder;
+
+	decoder.pf = fopen(filename, "rb");
+
+	bool ok = decoder.pf != NULL && fread(&decoder.header, sizeof(sequenceHeader), 1, decoder.pf) == 1
+		&& memcmp(decoder.header.magic, SEQUENCE_MAGIC, sizeof(decoder.header.magic)) == 0;
+
+	// the size is checked before the output of that size is allocated
+	ok = ok && decoder.header.width > 0 && decoder.header.height > 0
+		&& (long long)decoder.header.width * decoder.header.height <= MAX_CONTAINER_PIXELS
+		&& decoder.header.quality >= 1 && decoder.header.quality <= maxQuality();
+
+	if (!ok) {
+		puts("Error opening the file...");
+
+		if (decoder.pf != NULL) {
+			fclose(decoder.pf);
+			decoder.pf = NULL;
+		}
+
+		decoder.header.width = decoder.header.height = 0;
+		decoder.header.quality = DEFAULT_QUALITY;
+	}
+
+	decoder.blocksX = (decoder.header.width + 7) / 8;
+	decoder.blocksY = (decoder.header.height + 7) / 8;
+	decoder.output = Mat_<Vec3b>(8 * decoder.blocksY, 8 * decoder.blocksX, Vec3b(0, 0, 0));
+
+	return decoder;
+}
+
+// Updates the changed blocks of the persistent output and gives a copy of it at the size of the frames;
+// returns false when there are no more frames
+bool decodeFrame(sequenceDecoder* decoder, Mat_<Vec3b>* frame) {
+	if (decoder->pf == NULL) {
+		return false;
+	}
+
+	for (int x = 0; x < decoder->blocksX; x++) {
+		for (int y = 0; y < decoder->blocksY; y++) {
+			rleElement first;
+
+			if (fread(&first, sizeof(rleElement), 1, decoder->pf) != 1) {
+				return false;
+			}
+
+			if (first.val == SKIP.val && first.count == SKIP.count) {
+				continue;
+			}
+
+			fseek(decoder->pf, -(long)sizeof(rleElement), SEEK_CUR);
+
+			Mat_<Vec3b> decompressed(8, 8);
+
+			for (int c = 0; c < COMPONENTS; c++) {
+				rleElement* code = readBlock(decoder->pf);
+				Mat_<uchar> block = decompressBLock(code, decoder->header.quality);
+
+				for (int i = 0; i < 8; i++) {
+					for (int j = 0; j < 8; j++) {
+						decompressed(i, j)[c] = block(i, j);
+					}
+				}
+
+				free(code);
+			}
+
+			Mat_<Vec3b> bgr(8, 8);
+
+			cvtColor(decompressed, bgr, COLOR_YCrCb2BGR);
+
+			for (int i = 0; i < 8; i++) {
+				for (int j = 0; j < 8; j++) {
+					decoder->output(8 * y + i, 8 * x + j) = bgr(i, j);
+				}
+			}
+		}
+	}
+
+	// the padded output is kept for the next frame, so the caller gets its own copy
+	*frame = decoder->output(Rect(0, 0, decoder->header.width, decoder->header.height)).clone();
+
+	return true;
+}
+
+void closeSequenceDecoder(sequenceDecoder* decoder) {
+	if (decoder->pf != NULL) {
+		fclose(decoder->pf);
+		decoder->pf = NULL;
+	}
+}
@@ -0,0 +1,367 @@
+// JpegCodec.h : Declarations of the compression library shared by the console application and the tools.
+//
+
+#pragma once
+
+#include "common.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#define DEFAULT_QUALITY 50
+#define COEFFICIENTS_PER_BLOCK 64
+#define DEFAULT_BLOCK_SIZE 8
+#define COMPONENTS 3
+#define DEFAULT_SCAN_SCRIPT_LENGTH 6
+
+typedef struct {
+	char val;
+	uchar count;
+}rleElement;
+
+extern rleElement EOB;
+extern rleElement SKIP;
+
+// The 8x8 table at quality 50; BlockPipeline.h derives the tables of the other block sizes from it at compile time
+constexpr uchar quantizationValues[COEFFICIENTS_PER_BLOCK] = {
+	16, 11, 10, 16,  24,  40,  51,  61,
+	12, 12, 14, 19,  26,  58,  60,  55,
+	14, 13, 16, 24,  40,  57,  69,  56,
+	14, 17, 22, 29,  51,  87,  80,  62,
+	18, 22, 37, 56,  68, 109, 103,  77,
+	24, 35, 55, 64,  81, 104, 113,  92,
+	49, 64, 78, 87, 103, 121, 120, 101,
+	72, 92, 95, 98, 112, 100, 103,  99
+};
+
+// *************************************************************************************************
+//							Auxiliary Functions
+// *************************************************************************************************
+
+int minInt(int x, int y);
+int maxInt(int x, int y);
+bool isInside(cv::Mat img, int i, int j);
+int getNumberOfBlocksX(cv::Mat img, int sizeOfBlock);
+int getNumberOfBlocksY(cv::Mat img, int sizeOfBlock);
+bool isSupportedBlockSize(int blockSize);
+
+// The highest quality the format can represent with this block size; higher ones are coded as this one
+int maxQuality(int blockSize = DEFAULT_BLOCK_SIZE);
+
+// The quality a request is actually coded with: within 1 and maxQuality(blockSize)
+int effectiveQuality(int quality, int blockSize = DEFAULT_BLOCK_SIZE);
+
+// Clamps a quality given on the command line to effectiveQuality, saying so when it changes
+int checkQualityArgument(int quality, int blockSize = DEFAULT_BLOCK_SIZE);
+cv::Mat_<uchar> quantizationTable(int quality);
+cv::Mat_<uchar> get8x8BlockAt(int x, int y, cv::Mat_<uchar> img);
+cv::Mat_<uchar> getLuminance(cv::Mat_<cv::Vec3b> img);
+cv::Mat_<uchar> getRedChromatics(cv::Mat_<cv::Vec3b> img);
+cv::Mat_<uchar> getBlueChromatics(cv::Mat_<cv::Vec3b> img);
+
+// *************************************************************************************************
+//							Compression
+// *************************************************************************************************
+
+cv::Mat_<uchar> chromaticDownsampling(cv::Mat_<uchar> component);
+cv::Mat_<cv::Vec3b> colorSpaceConversion(cv::Mat_<cv::Vec3b> img);
+cv::Mat_<float> convertToSigned(cv::Mat_<uchar> block);
+float ci(int i, int n);
+cv::Mat_<float> discreteCosineTransform(cv::Mat_<float> block);
+char quantizeCoefficient(float coefficient, uchar q);
+cv::Mat_<char> quantization(cv::Mat_<float> block, int quality = DEFAULT_QUALITY);
+char* zigZagTraversal(cv::Mat_<char> mat);
+rleElement* rle(char* vals, int len, int* newLen);
+void writeBlock(rleElement* vals, const char* filename);
+rleElement* readBlock(FILE* pf, bool* complete = NULL);
+rleElement* encodeBlock(cv::Mat_<uchar> block, int* len, int quality = DEFAULT_QUALITY);
+
+// *************************************************************************************************
+//							Block Cache
+// *************************************************************************************************
+
+// An LRU map from blocks to their codes, bounded by maxBytes. It is not thread-safe: every thread (or
+// every Encoder used from its own thread) needs a cache of its own, or the caller has to lock around it.
+typedef struct {
+	unsigned long long key;
+	uchar samples[64];
+	int quality;
+	std::vector<rleElement> code;
+}blockCacheEntry;
+
+typedef struct {
+	std::list<blockCacheEntry> entries;
+	std::unordered_map<unsigned long long, std::list<blockCacheEntry>::iterator> index;
+	size_t bytes;
+	size_t maxBytes;
+	long long hits;
+	long long misses;
+	long long evictions;
+}blockCache;
+
+blockCache createBlockCache(size_t maxBytes);
+size_t blockCacheEntrySize(blockCacheEntry* entry);
+unsigned long long hashBlock(uchar* samples, int quality);
+rleElement* encodeBlockCached(blockCache* cache, cv::Mat_<uchar> block, int* len, int quality = DEFAULT_QUALITY);
+void printBlockCacheStatistics(blockCache* cache);
+
+void compressBlock(cv::Mat_<uchar> block, const char* compressedFileName, int quality = DEFAULT_QUALITY, blockCache* cache = NULL);
+void compressImage(cv::Mat_<cv::Vec3b> img, const char* filename, int quality = DEFAULT_QUALITY, blockCache* cache = NULL);
+
+// *************************************************************************************************
+//							Decompression
+// *************************************************************************************************
+
+char* rleDecode(rleElement* e);
+cv::Mat_<char> zigZagReconstruction(char* vals);
+cv::Mat_<float> dequantization(cv::Mat_<char> qBlock, int quality = DEFAULT_QUALITY);
+cv::Mat_<float> inverseDiscreteCosineTransform(cv::Mat_<float> tBlock);
+cv::Mat_<uchar> convertToUnsigned(cv::Mat_<float> block);
+cv::Mat_<uchar> decompressZigZagBlock(char* decoded, int quality = DEFAULT_QUALITY);
+cv::Mat_<uchar> decompressBLock(rleElement* code, int quality = DEFAULT_QUALITY);
+cv::Mat_<cv::Vec3b> decompressImage(const char* filename, int sizeX, int sizeY, int quality = DEFAULT_QUALITY);
+
+// *************************************************************************************************
+//							Library API
+// *************************************************************************************************
+
+#define CONTAINER_MAGIC "JPC2"
+// Containers written before the block size was recorded; their header stops before blockSize and their blocks are 8x8
+#define LEGACY_CONTAINER_MAGIC "JPC1"
+// The largest image a container may describe; the decoder allocates the padded image before reading any block
+#define MAX_CONTAINER_PIXELS (1LL << 28)
+
+// Header of a self-describing stream: the image size, quality and block size the decoder would otherwise be told
+typedef struct {
+	char magic[4];
+	int width;
+	int height;
+	int quality;
+	int blockSize;
+}containerHeader;
+
+bool readFileBytes(const char* filename, std::vector<uint8_t>& bytes);
+bool writeFileBytes(const char* filename, const uint8_t* bytes, size_t size);
+void appendContainerHeader(std::vector<uint8_t>& out, int width, int height, int quality, int blockSize = DEFAULT_BLOCK_SIZE);
+
+// Returns the length of the header at the start of data (legacy headers included), or 0 if there is none.
+// A header is also refused if its image is above MAX_CONTAINER_PIXELS or if the rest of data is too short
+// for its blocks, which take at least an EOB per component each.
+size_t readContainerHeader(const uint8_t* data, size_t size, containerHeader* header);
+
+// Converts img to YCrCb and splits it into one plane per component. With subsampling the chroma planes are
+// averaged over 2x2 pixels but keep their full size; the blur only makes their blocks cheaper to code.
+void splitComponents(const cv::Mat_<cv::Vec3b>& img, cv::Mat_<cv::Vec3b>& converted, cv::Mat_<uchar>* planes, bool subsampling);
+
+// The stream lists the blocks column by column, so the blocks of one column form a contiguous piece of it.
+// The cache only holds 8x8 blocks; the other sizes are coded without it.
+void appendBlockColumn(cv::Mat_<uchar>* planes, int x, int quality, blockCache* cache, std::vector<uint8_t>& out, int blockSize = DEFAULT_BLOCK_SIZE);
+
+// Encodes images into the same stream compressImage writes, without going through the filesystem.
+// The colour planes are kept between calls, so reusing one encoder for images of the same size does
+// not reallocate them.
+class Encoder {
+public:
+	Encoder(int quality = DEFAULT_QUALITY, blockCache* cache = NULL);
+
+	void setQuality(int quality);
+	int getQuality() const;
+	void setCache(blockCache* cache);
+
+	// Blurs the chroma planes over 2x2 pixels before coding them, as 4:2:0 would see them, but still codes
+	// them at full resolution: the stream layout is unchanged and any decoder reads it
+	void setSubsampling(bool subsampling);
+	bool getSubsampling() const;
+
+	// 4, 8 or 16; returns false and keeps the current size for any other
+	bool setBlockSize(int blockSize);
+	int getBlockSize() const;
+
+	// Appends the stream of img to out and returns its length
+	size_t encode(const cv::Mat_<cv::Vec3b>& img, std::vector<uint8_t>& out);
+
+	// Returns the length of the stream, or 0 if it does not fit in capacity; required gets the length either way
+	size_t encode(const cv::Mat_<cv::Vec3b>& img, uint8_t* buffer, size_t capacity, size_t* required = NULL);
+
+	// Appends a container header followed by the stream and returns their length
+	size_t encodeContainer(const cv::Mat_<cv::Vec3b>& img, std::vector<uint8_t>& out);
+
+private:
+	int quality;
+	bool subsampling;
+	int blockSize;
+	blockCache* cache;
+	cv::Mat_<cv::Vec3b> converted;
+	cv::Mat_<uchar> planes[COMPONENTS];
+	std::vector<uint8_t> scratch;
+};
+
+// Decodes a stream held in memory; the blocks are laid out in the padded sizeX x sizeY block grid
+class Decoder {
+public:
+	Decoder(int quality = DEFAULT_QUALITY);
+
+	void setQuality(int quality);
+	int getQuality() const;
+
+	// The block size of the streams given to decode; containers carry their own
+	bool setBlockSize(int blockSize);
+	int getBlockSize() const;
+
+	// Returns false if the stream ends before every block was decoded
+	bool decode(const uint8_t* data, size_t size, int sizeX, int sizeY, cv::Mat_<cv::Vec3b>& out);
+
+	// Decodes a stream written by Encoder::encodeContainer at its original size, quality and block size
+	bool decodeContainer(const uint8_t* data, size_t size, cv::Mat_<cv::Vec3b>& out);
+
+private:
+	int quality;
+	int blockSize;
+	cv::Mat_<cv::Vec3b> decompressed;
+	cv::Mat_<cv::Vec3b> padded;
+};
+
+// *************************************************************************************************
+//							Progressive Compression
+// *************************************************************************************************
+
+typedef struct {
+	uchar start;
+	uchar end;
+	uchar shift;
+	uchar refinement;
+}scanDescriptor;
+
+#define PROGRESSIVE_MAGIC "JPS1"
+
+// Starts a progressive file, ahead of its scans, so the decoder needs nothing from outside
+typedef struct {
+	char magic[4];
+	int width;
+	int height;
+	int quality;
+}progressiveHeader;
+
+typedef struct {
+	scanDescriptor scan;
+	int length;
+}scanHeader;
+
+typedef struct {
+	int blocksX;
+	int blocksY;
+	char* values;
+}coefficientBuffer;
+
+extern scanDescriptor defaultScanScript[];
+
+coefficientBuffer allocateCoefficientBuffer(int blocksX, int blocksY);
+char* coefficientsAt(coefficientBuffer* buffer, int x, int y, int component);
+coefficientBuffer bufferQuantizedCoefficients(cv::Mat_<cv::Vec3b> img, int quality = DEFAULT_QUALITY);
+char scanValue(char coefficient, scanDescriptor scan);
+void applyScanValue(char* coefficient, char value, scanDescriptor scan);
+rleElement* encodeScan(coefficientBuffer* coefficients, coefficientBuffer* sent, scanDescriptor scan, int* scanLength);
+void compressProgressiveImage(cv::Mat_<cv::Vec3b> img, const char* filename, int quality = DEFAULT_QUALITY, scanDescriptor* script = defaultScanScript, int scriptLength = DEFAULT_SCAN_SCRIPT_LENGTH);
+
+// Returns the length of the header at the start of data, or 0 if there is none or it describes an image above
+// MAX_CONTAINER_PIXELS or a quality the encoder does not use
+size_t readProgressiveHeader(const uint8_t* data, size_t size, progressiveHeader* header);
+int decodeScans(uchar* stream, int available, coefficientBuffer* coefficients);
+cv::Mat_<cv::Vec3b> renderCoefficients(coefficientBuffer* coefficients, int quality = DEFAULT_QUALITY);
+
+// Both render the complete scans among the first available bytes at the size of the image; the result is
+// empty if the header has not arrived or is not valid
+cv::Mat_<cv::Vec3b> decompressProgressiveImage(uchar* stream, int available, int* scansDecoded);
+cv::Mat_<cv::Vec3b> decompressProgressiveImage(const char* filename, int availableBytes);
+
+// *************************************************************************************************
+//							Rate Control
+// *************************************************************************************************
+
+typedef struct {
+	int blocksX;
+	int blocksY;
+	cv::Mat_<float> planes[COMPONENTS];
+}transformedImage;
+
+void getZigZagOrder(int* order);
+transformedImage transformImage(cv::Mat_<cv::Vec3b> img);
+void quantizeTransformedBlock(transformedImage* t, int x, int y, int component, cv::Mat_<uchar> q, int* order, char* vals);
+int estimateCompressedSize(transformedImage* t, int quality);
+void writeTransformedImage(transformedImage* t, int quality, const char* filename);
+int compressImageToSize(cv::Mat_<cv::Vec3b> img, const char* filename, int maxBytes);
+
+// *************************************************************************************************
+//							Transcoding
+// *************************************************************************************************
+
+// Returns false if the input ends before sizeX x sizeY blocks; the output then stops at the first missing block
+bool transcodeImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, int oldQuality, int newQuality);
+
+// *************************************************************************************************
+//							Lossless Transformations
+// *************************************************************************************************
+
+typedef enum {
+	TRANSFORM_NONE,
+	FLIP_HORIZONTAL,
+	FLIP_VERTICAL,
+	TRANSPOSE,
+	TRANSVERSE,
+	ROTATE_90,
+	ROTATE_180,
+	ROTATE_270
+}blockTransform;
+
+coefficientBuffer readCoefficients(const char* filename, int sizeX, int sizeY);
+void writeCoefficients(coefficientBuffer* coefficients, const char* filename);
+char negateCoefficient(char value);
+coefficientBuffer transformCoefficients(coefficientBuffer* src, bool transpose, bool flipX, bool flipY, int quality = DEFAULT_QUALITY);
+coefficientBuffer transformCoefficients(coefficientBuffer* src, blockTransform transform, int quality = DEFAULT_QUALITY);
+blockTransform exifOrientationTransform(int orientation);
+coefficientBuffer cropCoefficients(coefficientBuffer* src, int x, int y, int width, int height);
+void transformCompressedImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, blockTransform transform, int quality = DEFAULT_QUALITY);
+void cropCompressedImage(const char* inputFilename, const char* outputFilename, int sizeX, int sizeY, int x, int y, int width, int height);
+
+// *************************************************************************************************
+//							Frame Sequences
+// *************************************************************************************************
+
+#define SEQUENCE_MAGIC "JSQ1"
+
+typedef struct {
+	char magic[4];
+	int width;
+	int height;
+	int quality;
+}sequenceHeader;
+
+typedef struct {
+	FILE* pf;
+	sequenceHeader header;
+	int blocksX;
+	int blocksY;
+	cv::Mat_<cv::Vec3b> previous;
+	bool first;
+}sequenceEncoder;
+
+typedef struct {
+	FILE* pf;
+	sequenceHeader header;
+	int blocksX;
+	int blocksY;
+	cv::Mat_<cv::Vec3b> output;
+}sequenceDecoder;
+
+cv::Mat_<cv::Vec3b> getBGRBlockAt(int x, int y, cv::Mat_<cv::Vec3b> img);
+bool blockChanged(cv::Mat_<cv::Vec3b> previous, cv::Mat_<cv::Vec3b> current, int x, int y);
+sequenceEncoder openSequenceEncoder(const char* filename, int width, int height, int quality = DEFAULT_QUALITY);
+int encodeFrame(sequenceEncoder* encoder, cv::Mat_<cv::Vec3b> frame);
+void closeSequenceEncoder(sequenceEncoder* encoder);
+// pf is NULL if the file does not start with a valid header, with the same limits as readContainerHeader
+sequenceDecoder openSequenceDecoder(const char* filename);
+// frame is a copy at the size of the header, which the next call does not change
+bool decodeFrame(sequenceDecoder* decoder, cv::Mat_<cv::Vec3b>* frame);
+void closeSequenceDecoder(sequenceDecoder* decoder);
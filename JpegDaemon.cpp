@@ -0,0 +1,653 @@
+// JpegDaemon.cpp : Long-running service that compresses and decompresses images for local clients over a Unix domain socket.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "DaemonProtocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+
+int main() {
+	puts("The daemon needs Unix domain sockets and POSIX shared memory, which this platform does not have");
+	return 1;
+}
+
+#else
+
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+#define COMMANDS 2
+
+typedef struct {
+	string socketPath;
+	int workers;
+	// requests admitted at once over all the connections; the next ones wait unread in their socket
+	int maxInFlight;
+	// requests a worker takes off the queue at once
+	int batchSize;
+	// the percentiles are computed over the last latencyWindow requests of each command
+	int latencyWindow;
+}daemonOptions;
+
+typedef struct daemonConnection {
+	int fd;
+	// answers of one connection are written by several workers
+	mutex writeMutex;
+
+	~daemonConnection() {
+		close(fd);
+	}
+}daemonConnection;
+
+typedef struct {
+	shared_ptr<daemonConnection> connection;
+	requestHeader header;
+	vector<uint8_t> inlinePayload;
+	const uint8_t* sharedPayload;
+	chrono::steady_clock::time_point received;
+}daemonJob;
+
+// Pre-allocated codec state of one worker, reused by every request it serves
+typedef struct {
+	Encoder encoder;
+	Decoder decoder;
+	Mat_<Vec3b> image;
+	vector<uint8_t> output;
+}workerContext;
+
+typedef struct {
+	long long requests;
+	long long failed;
+	long long bytesIn;
+	long long bytesOut;
+	// ring buffer of the last latencies in seconds
+	vector<double> latencies;
+	size_t next;
+}commandStatistics;
+
+typedef struct {
+	daemonOptions options;
+	chrono::steady_clock::time_point started;
+
+	mutex queueMutex;
+	condition_variable queueReady;
+	deque<daemonJob*> queue;
+	bool closing;
+
+	mutex admissionMutex;
+	condition_variable admissionFree;
+	int inFlight;
+	int peakInFlight;
+	bool stopping;
+
+	mutex connectionsMutex;
+	condition_variable connectionsDone;
+	map<int, shared_ptr<daemonConnection>> connections;
+	long long connectionsAccepted;
+
+	mutex statisticsMutex;
+	commandStatistics statistics[COMMANDS];
+	long long batches;
+	long long batchedRequests;
+
+	atomic<uint32_t> sharedSequence;
+}daemonState;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int) {
+	stopRequested = 1;
+}
+
+// *************************************************************************************************
+//							Statistics
+// *************************************************************************************************
+
+void recordRequest(daemonState* state, int command, double seconds, bool ok, size_t bytesIn, size_t bytesOut) {
+	lock_guard<mutex> lock(state->statisticsMutex);
+
+	commandStatistics& s = state->statistics[command - COMMAND_COMPRESS];
+
+	s.requests++;
+	s.failed += ok ? 0 : 1;
+	s.bytesIn += bytesIn;
+	s.bytesOut += bytesOut;
+
+	if ((int)s.latencies.size() < state->options.latencyWindow) {
+		s.latencies.push_back(seconds);
+	}
+	else {
+		s.latencies[s.next] = seconds;
+		s.next = (s.next + 1) % s.latencies.size();
+	}
+}
+
+double percentile(vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+
+	return sorted[minInt((int)(p * sorted.size()), (int)sorted.size() - 1)];
+}
+
+string statisticsJson(daemonState* state) {
+	char text[512];
+	string json;
+
+	double uptime = chrono::duration<double>(chrono::steady_clock::now() - state->started).count();
+
+	int inFlight, peakInFlight;
+	{
+		lock_guard<mutex> lock(state->admissionMutex);
+		inFlight = state->inFlight;
+		peakInFlight = state->peakInFlight;
+	}
+
+	size_t connections;
+	long long connectionsAccepted;
+	{
+		lock_guard<mutex> lock(state->connectionsMutex);
+		connections = state->connections.size();
+		connectionsAccepted = state->connectionsAccepted;
+	}
+
+	lock_guard<mutex> lock(state->statisticsMutex);
+
+	snprintf(text, sizeof(text), "{\n  \"uptime_seconds\": %.3f,\n  \"workers\": %d,\n  \"max_in_flight\": %d,\n  \"batch_size\": %d,\n"
+		"  \"in_flight\": %d,\n  \"peak_in_flight\": %d,\n  \"connections\": %zu,\n  \"connections_accepted\": %lld,\n"
+		"  \"batches\": %lld,\n  \"mean_batch\": %.2f,\n",
+		uptime, state->options.workers, state->options.maxInFlight, state->options.batchSize, inFlight, peakInFlight,
+		connections, connectionsAccepted, state->batches, state->batches ? (double)state->batchedRequests / state->batches : 0);
+	json += text;
+
+	const char* names[COMMANDS] = { "compress", "decompress" };
+
+	for (int c = 0; c < COMMANDS; c++) {
+		commandStatistics& s = state->statistics[c];
+
+		vector<double> sorted = s.latencies;
+		sort(sorted.begin(), sorted.end());
+
+		snprintf(text, sizeof(text), "  \"%s\": { \"requests\": %lld, \"failed\": %lld, \"bytes_in\": %lld, \"bytes_out\": %lld, "
+			"\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }%s\n",
+			names[c], s.requests, s.failed, s.bytesIn, s.bytesOut,
+			percentile(sorted, 0.5) * 1000, percentile(sorted, 0.9) * 1000, percentile(sorted, 0.99) * 1000,
+			sorted.empty() ? 0 : sorted.back() * 1000, c + 1 < COMMANDS ? "," : "");
+		json += text;
+	}
+
+	json += "}\n";
+
+	return json;
+}
+
+// *************************************************************************************************
+//							Requests
+// *************************************************************************************************
+
+bool sendResponse(daemonState* state, daemonConnection* connection, responseHeader* response, const uint8_t* data, size_t size, uint64_t sharedThreshold) {
+	response->magic = DAEMON_MAGIC;
+	response->payloadSize = size;
+	response->sharedName[0] = 0;
+
+	bool shared = sharedThreshold > 0 && size > sharedThreshold
+		&& createSharedPayload("jpegd", state->sharedSequence++, data, size, response->sharedName);
+
+	lock_guard<mutex> lock(connection->writeMutex);
+
+	bool sent = sendAll(connection->fd, response, sizeof(responseHeader)) && (shared || sendAll(connection->fd, data, size));
+
+	if (!sent && shared) {
+		shm_unlink(response->sharedName);
+	}
+
+	return sent;
+}
+
+void sendError(daemonState* state, daemonConnection* connection, requestHeader* request, int status) {
+	responseHeader response = {};
+
+	response.id = request->id;
+	response.status = status;
+
+	sendResponse(state, connection, &response, NULL, 0, 0);
+}
+
+void processJob(daemonState* state, workerContext* context, daemonJob* job) {
+	requestHeader* request = &job->header;
+	responseHeader response = {};
+
+	response.id = request->id;
+	response.status = STATUS_OK;
+
+	const uint8_t* payload = job->sharedPayload != NULL ? job->sharedPayload : job->inlinePayload.data();
+	size_t payloadSize = request->payloadSize;
+
+	context->output.clear();
+
+	// an image OpenCV cannot allocate throws on this thread, which would take the whole daemon down
+	try {
+		if (request->command == COMMAND_COMPRESS) {
+			Mat_<Vec3b> img(request->height, request->width, (Vec3b*)payload);
+
+			context->encoder.setQuality(request->quality);
+			context->encoder.setSubsampling(request->subsampling != 0);
+			context->encoder.encodeContainer(img, context->output);
+		}
+		else {
+			// a payload that is not a container leaves the image alone, so the one of the previous request must go
+			context->image.release();
+
+			if (!context->decoder.decodeContainer(payload, payloadSize, context->image)) {
+				response.status = context->image.empty() ? STATUS_INVALID_PAYLOAD : STATUS_TRUNCATED;
+			}
+
+			if (!context->image.empty()) {
+				size_t rowBytes = (size_t)context->image.cols * sizeof(Vec3b);
+
+				context->output.resize(context->image.rows * rowBytes);
+
+				for (int i = 0; i < context->image.rows; i++) {
+					memcpy(&context->output[i * rowBytes], &context->image(i, 0), rowBytes);
+				}
+
+				response.width = context->image.cols;
+				response.height = context->image.rows;
+			}
+		}
+	}
+	catch (const exception&) {
+		response.status = STATUS_INTERNAL_ERROR;
+		response.width = response.height = 0;
+		context->output.clear();
+	}
+
+	sendResponse(state, job->connection.get(), &response, context->output.data(), context->output.size(), request->sharedThreshold);
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - job->received).count();
+
+	recordRequest(state, request->command, seconds, response.status == STATUS_OK, payloadSize, context->output.size());
+}
+
+void releaseJob(daemonState* state, daemonJob* job) {
+	if (job->sharedPayload != NULL) {
+		unmapSharedPayload(job->sharedPayload, job->header.payloadSize);
+	}
+
+	delete job;
+
+	lock_guard<mutex> lock(state->admissionMutex);
+	state->inFlight--;
+	state->admissionFree.notify_one();
+}
+
+void workerLoop(daemonState* state) {
+	workerContext* context = new workerContext;
+	vector<daemonJob*> batch;
+
+	while (true) {
+		{
+			unique_lock<mutex> lock(state->queueMutex);
+
+			state->queueReady.wait(lock, [state]() { return state->closing || !state->queue.empty(); });
+
+			if (state->queue.empty()) {
+				break;
+			}
+
+			// taking several requests per wake-up saves a lock round trip and a context switch for each of them
+			while (!state->queue.empty() && (int)batch.size() < state->options.batchSize) {
+				batch.push_back(state->queue.front());
+				state->queue.pop_front();
+			}
+		}
+
+		{
+			lock_guard<mutex> lock(state->statisticsMutex);
+			state->batches++;
+			state->batchedRequests += batch.size();
+		}
+
+		for (daemonJob* job : batch) {
+			processJob(state, context, job);
+			releaseJob(state, job);
+		}
+
+		batch.clear();
+	}
+
+	delete context;
+}
+
+// Checks what a request asks for before anything is allocated for it
+int validateRequest(requestHeader* request) {
+	if (request->command == COMMAND_STATS) {
+		return STATUS_OK;
+	}
+
+	if (request->command != COMMAND_COMPRESS && request->command != COMMAND_DECOMPRESS) {
+		return STATUS_INVALID_REQUEST;
+	}
+
+	if (request->sharedName[0] == 0 && request->payloadSize > MAX_INLINE_PAYLOAD) {
+		return STATUS_INVALID_REQUEST;
+	}
+
+	if (request->command == COMMAND_COMPRESS) {
+		// a quality the 8x8 tables cannot represent is refused rather than silently coded as a lower one
+		if (request->quality < 1 || request->quality > maxQuality() || request->width <= 0 || request->height <= 0) {
+			return STATUS_INVALID_REQUEST;
+		}
+
+		if (request->payloadSize != (uint64_t)request->width * request->height * sizeof(Vec3b)) {
+			return STATUS_INVALID_PAYLOAD;
+		}
+	}
+
+	return STATUS_OK;
+}
+
+// Reads the requests of one connection, answers the statistics itself and queues the rest for the workers
+void connectionLoop(daemonState* state, int id, shared_ptr<daemonConnection> connection) {
+	requestHeader request;
+
+	while (receiveAll(connection->fd, &request, sizeof(requestHeader))) {
+		auto received = chrono::steady_clock::now();
+
+		if (request.magic != DAEMON_MAGIC) {
+			break;
+		}
+
+		int status = validateRequest(&request);
+
+		if (status != STATUS_OK) {
+			sendError(state, connection.get(), &request, status);
+
+			// an inline payload that is not read leaves the stream out of sync, so the connection ends
+			if (request.sharedName[0] == 0 && request.payloadSize > 0) {
+				break;
+			}
+
+			continue;
+		}
+
+		if (request.command == COMMAND_STATS) {
+			string json = statisticsJson(state);
+			responseHeader response = {};
+
+			response.id = request.id;
+			sendResponse(state, connection.get(), &response, (const uint8_t*)json.data(), json.size(), 0);
+			continue;
+		}
+
+		{
+			unique_lock<mutex> lock(state->admissionMutex);
+
+			state->admissionFree.wait(lock, [state]() { return state->stopping || state->inFlight < state->options.maxInFlight; });
+
+			if (state->stopping) {
+				break;
+			}
+
+			state->inFlight++;
+			state->peakInFlight = maxInt(state->peakInFlight, state->inFlight);
+		}
+
+		daemonJob* job = new daemonJob;
+
+		job->connection = connection;
+		job->header = request;
+		job->sharedPayload = NULL;
+		job->received = received;
+
+		bool ok = true;
+
+		if (request.sharedName[0] != 0) {
+			job->sharedPayload = mapSharedPayload(request.sharedName, request.payloadSize);
+			ok = job->sharedPayload != NULL || request.payloadSize == 0;
+		}
+		else {
+			job->inlinePayload.resize(request.payloadSize);
+			ok = receiveAll(connection->fd, job->inlinePayload.data(), request.payloadSize);
+		}
+
+		if (!ok) {
+			sendError(state, connection.get(), &request, STATUS_INVALID_PAYLOAD);
+			releaseJob(state, job);
+
+			if (request.sharedName[0] == 0) {
+				break;
+			}
+
+			continue;
+		}
+
+		{
+			lock_guard<mutex> lock(state->queueMutex);
+			state->queue.push_back(job);
+		}
+
+		state->queueReady.notify_one();
+	}
+
+	lock_guard<mutex> lock(state->connectionsMutex);
+	state->connections.erase(id);
+	state->connectionsDone.notify_all();
+}
+
+// *************************************************************************************************
+//							Daemon
+// *************************************************************************************************
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options]\n", program);
+	printf("  -S <path>       socket path (default: %s)\n", DAEMON_SOCKET);
+	printf("  -j <n>          worker threads (default: number of cores)\n");
+	printf("  -c <n>          requests in flight at once (default: 4 per worker)\n");
+	printf("  -B <n>          requests a worker takes at once (default: 4)\n");
+	printf("  -l <n>          requests per command kept for the latency percentiles (default: 4096)\n");
+}
+
+bool parseArguments(int argc, char** argv, daemonOptions* options) {
+	options->socketPath = DAEMON_SOCKET;
+	options->workers = maxInt((int)thread::hardware_concurrency(), 1);
+	options->maxInFlight = 0;
+	options->batchSize = 4;
+	options->latencyWindow = 4096;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "-S" && hasValue) {
+			options->socketPath = argv[++i];
+		}
+		else if (arg == "-j" && hasValue) {
+			options->workers = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-c" && hasValue) {
+			options->maxInFlight = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-B" && hasValue) {
+			options->batchSize = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "-l" && hasValue) {
+			options->latencyWindow = maxInt(atoi(argv[++i]), 1);
+		}
+		else {
+			return false;
+		}
+	}
+
+	if (options->maxInFlight == 0) {
+		options->maxInFlight = 4 * options->workers;
+	}
+
+	return options->socketPath.size() < sizeof(((sockaddr_un*)NULL)->sun_path);
+}
+
+int openListeningSocket(const string& path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	// a socket file nobody answers on is left over from a daemon that did not shut down cleanly
+	if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0) {
+		printf("A daemon is already listening on %s\n", path.c_str());
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	unlink(path.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+		printf("Cannot listen on %s\n", path.c_str());
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char** argv) {
+	daemonState* state = new daemonState;
+
+	if (!parseArguments(argc, argv, &state->options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	int listener = openListeningSocket(state->options.socketPath);
+
+	if (listener < 0) {
+		return 1;
+	}
+
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	state->started = chrono::steady_clock::now();
+	state->closing = false;
+	state->inFlight = state->peakInFlight = 0;
+	state->stopping = false;
+	state->connectionsAccepted = 0;
+	state->batches = state->batchedRequests = 0;
+	state->sharedSequence = 0;
+
+	for (int c = 0; c < COMMANDS; c++) {
+		state->statistics[c].requests = state->statistics[c].failed = 0;
+		state->statistics[c].bytesIn = state->statistics[c].bytesOut = 0;
+		state->statistics[c].next = 0;
+	}
+
+	vector<thread> workers;
+
+	for (int i = 0; i < state->options.workers; i++) {
+		workers.push_back(thread(workerLoop, state));
+	}
+
+	printf("Listening on %s with %d workers, %d requests in flight at most\n", state->options.socketPath.c_str(), state->options.workers, state->options.maxInFlight);
+	fflush(stdout);
+
+	int nextConnection = 0;
+
+	while (!stopRequested) {
+		pollfd waiting = { listener, POLLIN, 0 };
+
+		// the timeout bounds how long a stop signal waits to be noticed
+		if (poll(&waiting, 1, 250) <= 0) {
+			continue;
+		}
+
+		int fd = accept(listener, NULL, NULL);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		shared_ptr<daemonConnection> connection(new daemonConnection);
+		connection->fd = fd;
+
+		int id = nextConnection++;
+
+		{
+			lock_guard<mutex> lock(state->connectionsMutex);
+			state->connections[id] = connection;
+			state->connectionsAccepted++;
+		}
+
+		thread(connectionLoop, state, id, connection).detach();
+	}
+
+	close(listener);
+	unlink(state->options.socketPath.c_str());
+
+	// wake the connection threads out of their reads and their wait for admission, then let them finish
+	{
+		lock_guard<mutex> lock(state->admissionMutex);
+		state->stopping = true;
+		state->admissionFree.notify_all();
+	}
+
+	{
+		unique_lock<mutex> lock(state->connectionsMutex);
+
+		for (auto& entry : state->connections) {
+			shutdown(entry.second->fd, SHUT_RD);
+		}
+
+		state->connectionsDone.wait(lock, [state]() { return state->connections.empty(); });
+	}
+
+	// the requests already queued are still answered if their client is listening
+	{
+		lock_guard<mutex> lock(state->queueMutex);
+		state->closing = true;
+		state->queueReady.notify_all();
+	}
+
+	for (thread& t : workers) {
+		t.join();
+	}
+
+	printf("%s", statisticsJson(state).c_str());
+
+	delete state;
+
+	return 0;
+}
+
+#endif
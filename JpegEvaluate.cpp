@@ -0,0 +1,603 @@
+// JpegEvaluate.cpp : Rate, distortion and throughput of the codec over a corpus, checked against a stored baseline.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace fs = std::filesystem;
+
+typedef struct {
+	vector<string> inputs;
+	vector<int> qualities;
+	int syntheticImages;
+	// each round trip is timed this many times and the fastest is kept, which steadies the throughput
+	int repeat;
+	string baselineFile;
+	string saveBaselineFile;
+	bool json;
+	// regression thresholds, relative to the baseline
+	double maxSlowdownPercent;
+	double maxSizeGrowthPercent;
+	double maxPsnrLoss;
+	double maxSsimLoss;
+}evaluationOptions;
+
+typedef struct {
+	string name;
+	Mat_<Vec3b> img;
+}corpusImage;
+
+typedef struct {
+	int quality;
+	double bitsPerPixel;
+	double psnr;
+	double ssim;
+	double encodeMPs;
+	double decodeMPs;
+}configurationResult;
+
+// *************************************************************************************************
+//							Metrics
+// *************************************************************************************************
+
+double meanSquaredError(Mat_<Vec3b> a, Mat_<Vec3b> b) {
+	double sum = 0;
+
+	for (int i = 0; i < a.rows; i++) {
+		for (int j = 0; j < a.cols; j++) {
+			for (int c = 0; c < 3; c++) {
+				double e = (double)a(i, j)[c] - b(i, j)[c];
+				sum += e * e;
+			}
+		}
+	}
+
+	return sum / ((double)a.rows * a.cols * 3);
+}
+
+// Identical images get 100 dB rather than infinity, so means over a corpus stay finite
+double psnr(Mat_<Vec3b> a, Mat_<Vec3b> b) {
+	double mse = meanSquaredError(a, b);
+
+	return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 100;
+}
+
+Mat_<float> luma(Mat_<Vec3b> img) {
+	Mat_<float> y(img.rows, img.cols);
+
+	for (int i = 0; i < img.rows; i++) {
+		for (int j = 0; j < img.cols; j++) {
+			y(i, j) = 0.114f * img(i, j)[0] + 0.587f * img(i, j)[1] + 0.299f * img(i, j)[2];
+		}
+	}
+
+	return y;
+}
+
+// SSIM of the luma, averaged over 8x8 windows placed every 4 pixels (Wang et al. with a uniform window)
+double ssim(Mat_<Vec3b> a, Mat_<Vec3b> b) {
+	const double c1 = (0.01 * 255) * (0.01 * 255);
+	const double c2 = (0.03 * 255) * (0.03 * 255);
+
+	Mat_<float> x = luma(a);
+	Mat_<float> y = luma(b);
+
+	double sum = 0;
+	int windows = 0;
+
+	for (int i = 0; i + 8 <= x.rows; i += 4) {
+		for (int j = 0; j + 8 <= x.cols; j += 4) {
+			double mx = 0, my = 0, xx = 0, yy = 0, xy = 0;
+
+			for (int u = 0; u < 8; u++) {
+				for (int v = 0; v < 8; v++) {
+					double p = x(i + u, j + v);
+					double q = y(i + u, j + v);
+
+					mx += p;
+					my += q;
+					xx += p * p;
+					yy += q * q;
+					xy += p * q;
+				}
+			}
+
+			mx /= 64;
+			my /= 64;
+
+			double vx = xx / 64 - mx * mx;
+			double vy = yy / 64 - my * my;
+			double cxy = xy / 64 - mx * my;
+
+			sum += ((2 * mx * my + c1) * (2 * cxy + c2)) / ((mx * mx + my * my + c1) * (vx + vy + c2));
+			windows++;
+		}
+	}
+
+	return windows > 0 ? sum / windows : 1;
+}
+
+// *************************************************************************************************
+//							Corpus
+// *************************************************************************************************
+
+bool isImageFile(const fs::path& path) {
+	string extension = path.extension().string();
+
+	for (char& c : extension) {
+		c = (char)tolower(c);
+	}
+
+	const char* extensions[] = { ".bmp", ".png", ".jpg", ".jpeg", ".ppm", ".pgm", ".tif", ".tiff" };
+
+	for (const char* e : extensions) {
+		if (extension == e) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+vector<corpusImage> loadCorpus(vector<string>& inputs) {
+	vector<string> files;
+
+	for (const string& input : inputs) {
+		error_code ec;
+
+		if (fs::is_directory(input, ec)) {
+			for (const fs::directory_entry& entry : fs::recursive_directory_iterator(input, ec)) {
+				if (entry.is_regular_file() && isImageFile(entry.path())) {
+					files.push_back(entry.path().string());
+				}
+			}
+		}
+		else {
+			files.push_back(input);
+		}
+	}
+
+	sort(files.begin(), files.end());
+
+	vector<corpusImage> corpus;
+
+	for (const string& file : files) {
+		Mat_<Vec3b> img = imread(file, IMREAD_COLOR);
+
+		if (img.empty()) {
+			printf("Cannot read %s, skipped\n", file.c_str());
+			continue;
+		}
+
+		corpus.push_back({ file, img });
+	}
+
+	return corpus;
+}
+
+// Smooth gradients, noise, hard edges and fine texture at a few sizes, seeded so every run sees the
+// same pixels and the results stay comparable with a baseline
+vector<corpusImage> syntheticCorpus(int count) {
+	vector<corpusImage> corpus;
+	mt19937 generator(1234);
+	normal_distribution<float> noise(0.0f, 6.0f);
+
+	int sizes[][2] = { { 128, 96 }, { 256, 192 }, { 333, 201 } };
+	const char* kinds[] = { "gradient", "noise", "edges", "texture" };
+
+	for (int k = 0; k < count; k++) {
+		int kind = k % 4;
+		int width = sizes[k / 4 % 3][0];
+		int height = sizes[k / 4 % 3][1];
+
+		Mat_<Vec3b> img(height, width);
+
+		int tile = generator() % 24 + 8;
+		float frequency = (generator() % 100 + 20) / 400.0f;
+
+		for (int i = 0; i < height; i++) {
+			for (int j = 0; j < width; j++) {
+				float b, g, r;
+
+				if (kind == 0) {
+					b = 255.0f * j / width;
+					g = 255.0f * i / height;
+					r = 128 + 60 * sin((i + j) * 0.02f);
+				}
+				else if (kind == 1) {
+					b = 120 + 4 * noise(generator);
+					g = 100 + 4 * noise(generator);
+					r = 140 + 4 * noise(generator);
+				}
+				else if (kind == 2) {
+					bool on = ((i / tile) + (j / tile)) % 2 == 0;
+					b = on ? 230.0f : 20.0f;
+					g = on ? 200.0f : 40.0f;
+					r = on ? 30.0f : 210.0f;
+				}
+				else {
+					b = 128 + 100 * sin(frequency * j) * cos(frequency * i);
+					g = 128 + 80 * sin(frequency * (i + j));
+					r = 128 + 60 * cos(frequency * i * 1.7f) + noise(generator);
+				}
+
+				img(i, j) = Vec3b(saturate_cast<uchar>(b), saturate_cast<uchar>(g), saturate_cast<uchar>(r));
+			}
+		}
+
+		corpus.push_back({ string("synthetic-") + kinds[kind] + "-" + to_string(k), img });
+	}
+
+	return corpus;
+}
+
+// *************************************************************************************************
+//							Evaluation
+// *************************************************************************************************
+
+// Creates an empty file of its own in the temporary directory, so that evaluations running side by side do
+// not overwrite each other's streams
+bool createScratchFile(string& path) {
+	path = (fs::temp_directory_path() / "jpeg-evaluate-XXXXXX").string();
+
+#ifdef _WIN32
+	if (_mktemp_s(&path[0], path.size() + 1) != 0) {
+		return false;
+	}
+
+	// x fails if another process took the name in the meantime
+	FILE* pf = fopen(path.c_str(), "wbx");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	fclose(pf);
+#else
+	int fd = mkstemp(&path[0]);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	close(fd);
+#endif
+
+	return true;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Every round trip goes through the file at path
+configurationResult evaluateConfiguration(vector<corpusImage>& corpus, int quality, const string& path, evaluationOptions* options) {
+	const char* filename = path.c_str();
+
+	double megapixels = 0;
+	double bits = 0;
+	double psnrSum = 0;
+	double ssimSum = 0;
+	double encodeSeconds = 0;
+	double decodeSeconds = 0;
+
+	for (corpusImage& image : corpus) {
+		Mat_<Vec3b>& img = image.img;
+
+		int sizeX = getNumberOfBlocksX(img, 8);
+		int sizeY = getNumberOfBlocksY(img, 8);
+
+		double bestEncode = 0, bestDecode = 0;
+		Mat_<Vec3b> decoded;
+
+		for (int r = 0; r < options->repeat; r++) {
+			auto start = chrono::steady_clock::now();
+			compressImage(img, filename, quality);
+			double encode = secondsSince(start);
+
+			start = chrono::steady_clock::now();
+			decoded = decompressImage(filename, sizeX, sizeY, quality);
+			double decode = secondsSince(start);
+
+			bestEncode = r == 0 ? encode : min(bestEncode, encode);
+			bestDecode = r == 0 ? decode : min(bestDecode, decode);
+		}
+
+		error_code ec;
+		double size = (double)fs::file_size(path, ec);
+
+		// the decoder returns the padded block grid
+		Mat_<Vec3b> cropped = decoded(Rect(0, 0, img.cols, img.rows));
+
+		megapixels += (double)img.rows * img.cols / 1e6;
+		bits += 8 * size;
+		psnrSum += psnr(img, cropped);
+		ssimSum += ssim(img, cropped);
+		encodeSeconds += bestEncode;
+		decodeSeconds += bestDecode;
+	}
+
+	configurationResult result;
+
+	result.quality = quality;
+	result.bitsPerPixel = bits / (megapixels * 1e6);
+	result.psnr = psnrSum / corpus.size();
+	result.ssim = ssimSum / corpus.size();
+	result.encodeMPs = encodeSeconds > 0 ? megapixels / encodeSeconds : 0;
+	result.decodeMPs = decodeSeconds > 0 ? megapixels / decodeSeconds : 0;
+
+	return result;
+}
+
+// *************************************************************************************************
+//							Baseline
+// *************************************************************************************************
+
+// One line per configuration: quality bpp psnr ssim encodeMPs decodeMPs
+bool saveBaseline(const char* filename, vector<configurationResult>& results) {
+	FILE* pf = fopen(filename, "w");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	fprintf(pf, "# quality bits_per_pixel psnr ssim encode_mp_per_s decode_mp_per_s\n");
+
+	for (configurationResult& r : results) {
+		fprintf(pf, "%d %.6f %.6f %.6f %.6f %.6f\n", r.quality, r.bitsPerPixel, r.psnr, r.ssim, r.encodeMPs, r.decodeMPs);
+	}
+
+	fclose(pf);
+
+	return true;
+}
+
+bool loadBaseline(const char* filename, vector<configurationResult>& baseline) {
+	FILE* pf = fopen(filename, "r");
+
+	if (pf == NULL) {
+		return false;
+	}
+
+	char line[256];
+
+	while (fgets(line, sizeof(line), pf) != NULL) {
+		configurationResult r;
+
+		if (line[0] == '#') {
+			continue;
+		}
+
+		if (sscanf(line, "%d %lf %lf %lf %lf %lf", &r.quality, &r.bitsPerPixel, &r.psnr, &r.ssim, &r.encodeMPs, &r.decodeMPs) == 6) {
+			baseline.push_back(r);
+		}
+	}
+
+	fclose(pf);
+
+	return true;
+}
+
+// Prints every metric past its threshold to stderr, which keeps a JSON report valid, and returns their count
+int compareWithBaseline(vector<configurationResult>& results, vector<configurationResult>& baseline, evaluationOptions* options) {
+	int regressions = 0;
+
+	for (configurationResult& r : results) {
+		configurationResult* b = NULL;
+
+		for (configurationResult& candidate : baseline) {
+			if (candidate.quality == r.quality) {
+				b = &candidate;
+			}
+		}
+
+		// a gate that has nothing to compare with must not pass
+		if (b == NULL) {
+			fprintf(stderr, "q%d: not in the baseline\n", r.quality);
+			regressions++;
+			continue;
+		}
+
+		if (r.bitsPerPixel > b->bitsPerPixel * (1 + options->maxSizeGrowthPercent / 100)) {
+			fprintf(stderr, "q%d: size regressed, %.4f bpp against %.4f\n", r.quality, r.bitsPerPixel, b->bitsPerPixel);
+			regressions++;
+		}
+
+		if (r.psnr < b->psnr - options->maxPsnrLoss) {
+			fprintf(stderr, "q%d: PSNR regressed, %.3f dB against %.3f\n", r.quality, r.psnr, b->psnr);
+			regressions++;
+		}
+
+		if (r.ssim < b->ssim - options->maxSsimLoss) {
+			fprintf(stderr, "q%d: SSIM regressed, %.4f against %.4f\n", r.quality, r.ssim, b->ssim);
+			regressions++;
+		}
+
+		if (r.encodeMPs < b->encodeMPs * (1 - options->maxSlowdownPercent / 100)) {
+			fprintf(stderr, "q%d: encoding slowed down, %.3f MP/s against %.3f\n", r.quality, r.encodeMPs, b->encodeMPs);
+			regressions++;
+		}
+
+		if (r.decodeMPs < b->decodeMPs * (1 - options->maxSlowdownPercent / 100)) {
+			fprintf(stderr, "q%d: decoding slowed down, %.3f MP/s against %.3f\n", r.quality, r.decodeMPs, b->decodeMPs);
+			regressions++;
+		}
+	}
+
+	return regressions;
+}
+
+// *************************************************************************************************
+//							Main
+// *************************************************************************************************
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options] [<file or directory>...]\n", program);
+	printf("  -q <list>              qualities to evaluate, comma separated (default: 10,25,50,75)\n");
+	printf("  --synthetic <n>        synthetic images used without inputs (default: 12)\n");
+	printf("  --repeat <n>           time every round trip n times and keep the fastest (default: 3)\n");
+	printf("  --baseline <file>      compare with a baseline, exit 1 on a regression\n");
+	printf("  --save-baseline <file> store the results as the new baseline\n");
+	printf("  --max-slowdown <%%>     throughput loss tolerated (default: 10)\n");
+	printf("  --max-size-growth <%%>  bits per pixel growth tolerated (default: 0.5)\n");
+	printf("  --max-psnr-loss <dB>   PSNR loss tolerated (default: 0.05)\n");
+	printf("  --max-ssim-loss <x>    SSIM loss tolerated (default: 0.001)\n");
+	printf("  --json                 print the results as JSON\n");
+}
+
+bool parseArguments(int argc, char** argv, evaluationOptions* options) {
+	options->qualities = { 10, 25, 50, 75 };
+	options->syntheticImages = 12;
+	options->repeat = 3;
+	options->json = false;
+	options->maxSlowdownPercent = 10;
+	options->maxSizeGrowthPercent = 0.5;
+	options->maxPsnrLoss = 0.05;
+	options->maxSsimLoss = 0.001;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "-q" && hasValue) {
+			options->qualities.clear();
+
+			for (char* q = strtok(argv[++i], ","); q != NULL; q = strtok(NULL, ",")) {
+				options->qualities.push_back(checkQualityArgument(atoi(q)));
+			}
+		}
+		else if (arg == "--synthetic" && hasValue) {
+			options->syntheticImages = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--repeat" && hasValue) {
+			options->repeat = maxInt(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--baseline" && hasValue) {
+			options->baselineFile = argv[++i];
+		}
+		else if (arg == "--save-baseline" && hasValue) {
+			options->saveBaselineFile = argv[++i];
+		}
+		else if (arg == "--max-slowdown" && hasValue) {
+			options->maxSlowdownPercent = atof(argv[++i]);
+		}
+		else if (arg == "--max-size-growth" && hasValue) {
+			options->maxSizeGrowthPercent = atof(argv[++i]);
+		}
+		else if (arg == "--max-psnr-loss" && hasValue) {
+			options->maxPsnrLoss = atof(argv[++i]);
+		}
+		else if (arg == "--max-ssim-loss" && hasValue) {
+			options->maxSsimLoss = atof(argv[++i]);
+		}
+		else if (arg == "--json") {
+			options->json = true;
+		}
+		else if (arg[0] == '-') {
+			return false;
+		}
+		else {
+			options->inputs.push_back(arg);
+		}
+	}
+
+	return !options->qualities.empty();
+}
+
+int main(int argc, char** argv) {
+	evaluationOptions options;
+
+	if (!parseArguments(argc, argv, &options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	vector<corpusImage> corpus = options.inputs.empty() ? syntheticCorpus(options.syntheticImages) : loadCorpus(options.inputs);
+
+	if (corpus.empty()) {
+		puts("No image to evaluate");
+		return 2;
+	}
+
+	string scratch;
+
+	if (!createScratchFile(scratch)) {
+		printf("Cannot create a temporary file in %s\n", fs::temp_directory_path().string().c_str());
+		return 2;
+	}
+
+	vector<configurationResult> results;
+
+	for (int quality : options.qualities) {
+		results.push_back(evaluateConfiguration(corpus, quality, scratch, &options));
+	}
+
+	remove(scratch.c_str());
+
+	if (options.json) {
+		printf("{\n  \"images\": %zu,\n  \"configurations\": [\n", corpus.size());
+
+		for (size_t i = 0; i < results.size(); i++) {
+			configurationResult& r = results[i];
+
+			printf("    { \"quality\": %d, \"bits_per_pixel\": %.4f, \"psnr\": %.3f, \"ssim\": %.4f, \"encode_mp_per_s\": %.3f, \"decode_mp_per_s\": %.3f }%s\n",
+				r.quality, r.bitsPerPixel, r.psnr, r.ssim, r.encodeMPs, r.decodeMPs, i + 1 < results.size() ? "," : "");
+		}
+
+		printf("  ]\n}\n");
+	}
+	else {
+		printf("%zu images%s\n", corpus.size(), options.inputs.empty() ? " (synthetic)" : "");
+		printf("%8s %10s %10s %8s %12s %12s\n", "Quality", "bpp", "PSNR dB", "SSIM", "Encode MP/s", "Decode MP/s");
+
+		for (configurationResult& r : results) {
+			printf("%8d %10.4f %10.3f %8.4f %12.3f %12.3f\n", r.quality, r.bitsPerPixel, r.psnr, r.ssim, r.encodeMPs, r.decodeMPs);
+		}
+	}
+
+	if (!options.saveBaselineFile.empty() && !saveBaseline(options.saveBaselineFile.c_str(), results)) {
+		printf("Cannot write %s\n", options.saveBaselineFile.c_str());
+		return 2;
+	}
+
+	if (!options.baselineFile.empty()) {
+		vector<configurationResult> baseline;
+
+		if (!loadBaseline(options.baselineFile.c_str(), baseline)) {
+			printf("Cannot read %s\n", options.baselineFile.c_str());
+			return 2;
+		}
+
+		if (baseline.empty()) {
+			fprintf(stderr, "No results in %s\n", options.baselineFile.c_str());
+			return 1;
+		}
+
+		int regressions = compareWithBaseline(results, baseline, &options);
+
+		if (regressions > 0) {
+			fprintf(stderr, "%d regressions against %s\n", regressions, options.baselineFile.c_str());
+			return 1;
+		}
+
+		fprintf(stderr, "No regression against %s\n", options.baselineFile.c_str());
+	}
+
+	return 0;
+}
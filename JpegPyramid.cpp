@@ -0,0 +1,195 @@
+// JpegPyramid.cpp : Builds tile pyramid archives for deep-zoom viewers, lists them and extracts single tiles.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "TilePyramid.h"
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+using namespace cv;
+using namespace std;
+
+namespace fs = std::filesystem;
+
+typedef struct {
+	string command;
+	vector<string> arguments;
+	pyramidOptions pyramid;
+}toolOptions;
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options] build <image> <archive>\n", program);
+	printf("       %s info <archive>\n", program);
+	printf("       %s extract <archive> <level> <x> <y> <image>\n", program);
+	printf("  -q <1-100>      quality, at most %d, %d and %d with -k 4, 8 and 16 (default: %d)\n", maxQuality(4), maxQuality(8), maxQuality(16), DEFAULT_QUALITY);
+	printf("  -s <444|420>    420 blurs the chroma over 2x2 pixels, which is still coded at full size (default: 444)\n");
+	printf("  -k <4|8|16>     block size (default: %d)\n", DEFAULT_BLOCK_SIZE);
+	printf("  -t <pixels>     tile size (default: %d)\n", DEFAULT_TILE_SIZE);
+	printf("  -l <n>          levels, 0 for down to a single tile (default: 0)\n");
+}
+
+bool parseArguments(int argc, char** argv, toolOptions* options) {
+	options->pyramid = defaultPyramidOptions();
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "-q" && hasValue) {
+			options->pyramid.quality = atoi(argv[++i]);
+		}
+		else if (arg == "-s" && hasValue) {
+			string mode = argv[++i];
+
+			if (mode != "444" && mode != "420") {
+				printf("Unknown subsampling %s\n", mode.c_str());
+				return false;
+			}
+
+			options->pyramid.subsampling = mode == "420";
+		}
+		else if (arg == "-k" && hasValue) {
+			options->pyramid.blockSize = atoi(argv[++i]);
+
+			if (!isSupportedBlockSize(options->pyramid.blockSize)) {
+				printf("Unsupported block size %s\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-t" && hasValue) {
+			options->pyramid.tileSize = atoi(argv[++i]);
+
+			if (options->pyramid.tileSize < 16 || options->pyramid.tileSize > 4096) {
+				printf("The tile size must be between 16 and 4096\n");
+				return false;
+			}
+		}
+		else if (arg == "-l" && hasValue) {
+			options->pyramid.maxLevels = maxInt(atoi(argv[++i]), 0);
+		}
+		else if (arg[0] == '-' && arg.size() > 1) {
+			return false;
+		}
+		else if (options->command.empty()) {
+			options->command = arg;
+		}
+		else {
+			options->arguments.push_back(arg);
+		}
+	}
+
+	// after the loop, as the highest quality depends on -k
+	options->pyramid.quality = checkQualityArgument(options->pyramid.quality, options->pyramid.blockSize);
+
+	size_t count = options->arguments.size();
+
+	return (options->command == "build" && count == 2) || (options->command == "info" && count == 1)
+		|| (options->command == "extract" && count == 5);
+}
+
+int buildPyramid(toolOptions* options) {
+	const string& input = options->arguments[0];
+	const string& archive = options->arguments[1];
+
+	Mat_<Vec3b> img = imread(input, IMREAD_COLOR);
+
+	if (img.empty()) {
+		printf("Cannot read %s\n", input.c_str());
+		return 1;
+	}
+
+	auto start = chrono::steady_clock::now();
+
+	if (!writeTilePyramid(img, archive.c_str(), &options->pyramid)) {
+		printf("Cannot write %s\n", archive.c_str());
+		return 1;
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	vector<pyramidLevel> levels = pyramidLevels(img.cols, img.rows, options->pyramid.tileSize, options->pyramid.maxLevels);
+	int tiles = levels.back().firstTile + levels.back().tilesX * levels.back().tilesY;
+
+	error_code ec;
+	uintmax_t bytes = fs::file_size(archive, ec);
+
+	printf("%s -> %s: %dx%d, %d levels, %d tiles, %ju bytes, %.3f s, %.2f MP/s\n", input.c_str(), archive.c_str(), img.cols, img.rows,
+		(int)levels.size(), tiles, bytes, seconds, seconds > 0 ? img.rows * (double)img.cols / 1e6 / seconds : 0.0);
+
+	return 0;
+}
+
+int printPyramidInfo(toolOptions* options) {
+	pyramidReader reader = openPyramidReader(options->arguments[0].c_str());
+
+	if (reader.pf == NULL) {
+		return 1;
+	}
+
+	pyramidHeader& header = reader.header;
+
+	printf("%dx%d, quality %d, %dx%d blocks, %dx%d tiles, %d levels\n", header.width, header.height, header.quality,
+		header.blockSize, header.blockSize, header.tileSize, header.tileSize, header.levels);
+
+	printf("%6s %12s %12s %8s\n", "Level", "Width", "Height", "Tiles");
+
+	for (size_t l = 0; l < reader.levels.size(); l++) {
+		pyramidLevel& level = reader.levels[l];
+
+		printf("%6zu %12d %12d %8d\n", l, level.width, level.height, level.tilesX * level.tilesY);
+	}
+
+	closePyramidReader(&reader);
+
+	return 0;
+}
+
+int extractTile(toolOptions* options) {
+	pyramidReader reader = openPyramidReader(options->arguments[0].c_str());
+
+	if (reader.pf == NULL) {
+		return 1;
+	}
+
+	int level = atoi(options->arguments[1].c_str());
+	int x = atoi(options->arguments[2].c_str());
+	int y = atoi(options->arguments[3].c_str());
+
+	Mat_<Vec3b> tile;
+	bool decoded = decodePyramidTile(&reader, level, x, y, tile);
+
+	closePyramidReader(&reader);
+
+	if (!decoded) {
+		printf("No tile (%d, %d) at level %d\n", x, y, level);
+		return 1;
+	}
+
+	if (!imwrite(options->arguments[4], tile)) {
+		printf("Cannot write %s\n", options->arguments[4].c_str());
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	toolOptions options;
+
+	if (!parseArguments(argc, argv, &options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	if (options.command == "build") {
+		return buildPyramid(&options);
+	}
+	else if (options.command == "info") {
+		return printPyramidInfo(&options);
+	}
+	else {
+		return extractTile(&options);
+	}
+}
@@ -0,0 +1,373 @@
+// JpegTests.cpp : Checks that every encoding path writes the same containers, that progressive and pyramid files
+// round trip and that corrupt headers are refused. Run by ctest; returns 1 if any check fails.
+//
+
+#include "stdafx.h"
+#include "JpegCodec.h"
+#include "ShardedEncoder.h"
+#include "TaskScheduler.h"
+#include "TilePyramid.h"
+#include <cstddef>
+
+using namespace cv;
+using namespace std;
+
+int checks = 0;
+int failures = 0;
+
+void check(bool condition, const char* what) {
+	checks++;
+
+	if (!condition) {
+		failures++;
+		printf("FAILED: %s\n", what);
+	}
+}
+
+// Gradients with some texture, at sizes that are not multiples of the block size so the padding is exercised
+Mat_<Vec3b> testImage(int height, int width, int seed) {
+	Mat_<Vec3b> img(height, width);
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			img(i, j) = Vec3b((uchar)(i * 2 + (i * j + seed) % 7), (uchar)(j * 3 + seed), (uchar)(100 + (i ^ j) % 50));
+		}
+	}
+
+	return img;
+}
+
+bool sameImage(const Mat_<Vec3b>& a, const Mat_<Vec3b>& b) {
+	if (a.rows != b.rows || a.cols != b.cols) {
+		return false;
+	}
+
+	for (int i = 0; i < a.rows; i++) {
+		for (int j = 0; j < a.cols; j++) {
+			for (int c = 0; c < COMPONENTS; c++) {
+				if (a(i, j)[c] != b(i, j)[c]) {
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+vector<uint8_t> encodeReference(const Mat_<Vec3b>& img, int quality, bool subsampling) {
+	Encoder encoder(quality);
+	vector<uint8_t> stream;
+
+	encoder.setSubsampling(subsampling);
+	encoder.encodeContainer(img, stream);
+
+	return stream;
+}
+
+// *************************************************************************************************
+//							Encoding Paths
+// *************************************************************************************************
+
+void testShardedEncoder() {
+	Mat_<Vec3b> img = testImage(77, 93, 1);
+
+	for (int workers = 1; workers <= 4; workers++) {
+		for (bool subsampling : { false, true }) {
+			shardOptions options = defaultShardOptions();
+			options.workers = workers;
+
+			vector<uint8_t> stream;
+
+			check(encodeSharded(img, 60, subsampling, &options, stream), "sharded encoding succeeds");
+			check(stream == encodeReference(img, 60, subsampling), "sharded container matches Encoder::encodeContainer");
+		}
+	}
+}
+
+void testScheduledBatch() {
+	vector<Mat_<Vec3b>> images = { testImage(77, 93, 1), testImage(8, 8, 2), testImage(130, 61, 3), testImage(1, 1, 4) };
+	WorkStealingScheduler scheduler(3);
+
+	for (bool subsampling : { false, true }) {
+		vector<vector<uint8_t>> streams = encodeBatch(scheduler, images, 40, subsampling);
+
+		check(streams.size() == images.size(), "scheduled batch codes every image");
+
+		for (size_t i = 0; i < streams.size() && i < images.size(); i++) {
+			check(streams[i] == encodeReference(images[i], 40, subsampling), "scheduled container matches Encoder::encodeContainer");
+		}
+	}
+}
+
+void testContainerRoundTrip() {
+	Mat_<Vec3b> img = testImage(77, 93, 5);
+
+	for (int blockSize : { 4, 8, 16 }) {
+		Encoder encoder(50);
+		Decoder decoder;
+		vector<uint8_t> stream;
+		Mat_<Vec3b> out;
+
+		encoder.setBlockSize(blockSize);
+		encoder.encodeContainer(img, stream);
+
+		check(decoder.decodeContainer(stream.data(), stream.size(), out), "container decodes");
+		check(out.rows == img.rows && out.cols == img.cols, "container decodes at the size of the image");
+	}
+}
+
+// *************************************************************************************************
+//							Progressive Compression
+// *************************************************************************************************
+
+void testProgressiveRoundTrip() {
+	Mat_<Vec3b> img = testImage(77, 93, 6);
+	const char* filename = "JpegTests.jps";
+
+	compressProgressiveImage(img, filename, 50);
+
+	vector<uint8_t> bytes;
+	check(readFileBytes(filename, bytes), "progressive file is written");
+	remove(filename);
+
+	// every scan refines the same quantized coefficients the sequential coder writes
+	Mat_<Vec3b> sequential;
+	vector<uint8_t> stream = encodeReference(img, 50, false);
+	Decoder decoder;
+	decoder.decodeContainer(stream.data(), stream.size(), sequential);
+
+	int scans = 0;
+	Mat_<Vec3b> complete = decompressProgressiveImage(bytes.data(), (int)bytes.size(), &scans);
+
+	check(scans == DEFAULT_SCAN_SCRIPT_LENGTH, "progressive decoder reads every scan");
+	check(sameImage(complete, sequential), "complete progressive image matches the sequential one");
+
+	// the first scan on its own already renders the whole image
+	if (bytes.size() >= sizeof(progressiveHeader) + sizeof(scanHeader)) {
+		scanHeader first;
+		memcpy(&first, bytes.data() + sizeof(progressiveHeader), sizeof(scanHeader));
+
+		int available = (int)(sizeof(progressiveHeader) + sizeof(scanHeader) + first.length * sizeof(rleElement));
+		Mat_<Vec3b> partial = decompressProgressiveImage(bytes.data(), available, &scans);
+
+		check(scans == 1, "partial progressive stream decodes its complete scans only");
+		check(partial.rows == img.rows && partial.cols == img.cols, "partial progressive image has the size of the image");
+
+		partial = decompressProgressiveImage(bytes.data(), (int)bytes.size() - 1, &scans);
+		check(scans == DEFAULT_SCAN_SCRIPT_LENGTH - 1, "progressive stream missing its last byte stops before the last scan");
+	}
+	else {
+		check(false, "progressive file holds a scan");
+	}
+
+	check(decompressProgressiveImage(bytes.data(), (int)sizeof(progressiveHeader) - 1, &scans).empty(), "progressive image needs its header");
+}
+
+// *************************************************************************************************
+//							Tile Pyramids
+// *************************************************************************************************
+
+void testPyramidRoundTrip() {
+	Mat_<Vec3b> img = testImage(77, 93, 7);
+	const char* filename = "JpegTests.jpp";
+
+	pyramidOptions options = defaultPyramidOptions();
+	options.tileSize = 32;
+
+	check(writeTilePyramid(img, filename, &options), "pyramid is written");
+
+	pyramidReader reader = openPyramidReader(filename);
+	check(reader.pf != NULL, "pyramid is read back");
+
+	if (reader.pf != NULL) {
+		vector<pyramidLevel> levels = pyramidLevels(img.cols, img.rows, options.tileSize, options.maxLevels);
+		check(reader.levels.size() == levels.size() && levels.size() == 3, "pyramid halves down to a single tile");
+
+		for (int l = 0; l < (int)reader.levels.size(); l++) {
+			pyramidLevel& level = reader.levels[l];
+
+			for (int y = 0; y < level.tilesY; y++) {
+				for (int x = 0; x < level.tilesX; x++) {
+					Mat_<Vec3b> tile;
+					int width = minInt(options.tileSize, level.width - x * options.tileSize);
+					int height = minInt(options.tileSize, level.height - y * options.tileSize);
+
+					check(decodePyramidTile(&reader, l, x, y, tile), "pyramid tile decodes");
+					check(tile.cols == width && tile.rows == height, "pyramid tile has the size of its part of the level");
+
+					// the source level is cut into tiles before coding, so its tiles are plain containers of the crops
+					if (l == 0) {
+						vector<uint8_t> bytes;
+						Mat_<Vec3b> crop = img(Rect(x * options.tileSize, y * options.tileSize, width, height)).clone();
+
+						readPyramidTile(&reader, l, x, y, bytes);
+						check(bytes == encodeReference(crop, options.quality, options.subsampling), "source tile matches Encoder::encodeContainer");
+					}
+				}
+			}
+		}
+
+		Mat_<Vec3b> tile;
+		check(!decodePyramidTile(&reader, (int)reader.levels.size(), 0, 0, tile), "pyramid refuses a level it does not have");
+		check(!decodePyramidTile(&reader, 0, reader.levels[0].tilesX, 0, tile), "pyramid refuses a tile outside its level");
+
+		closePyramidReader(&reader);
+	}
+
+	// a level table other than the one pyramidLevels gives for the header is refused
+	vector<uint8_t> bytes;
+	readFileBytes(filename, bytes);
+
+	if (bytes.size() >= sizeof(pyramidHeader) + sizeof(pyramidLevel)) {
+		pyramidLevel level;
+		memcpy(&level, bytes.data() + sizeof(pyramidHeader), sizeof(pyramidLevel));
+		level.tilesX += 1000;
+		memcpy(bytes.data() + sizeof(pyramidHeader), &level, sizeof(pyramidLevel));
+
+		writeFileBytes(filename, bytes.data(), bytes.size());
+		reader = openPyramidReader(filename);
+		check(reader.pf == NULL, "pyramid with a forged level table is refused");
+		closePyramidReader(&reader);
+	}
+
+	remove(filename);
+}
+
+// *************************************************************************************************
+//							Corrupt Input
+// *************************************************************************************************
+
+void testCorruptContainers() {
+	containerHeader header;
+	memcpy(header.magic, CONTAINER_MAGIC, 4);
+	header.quality = DEFAULT_QUALITY;
+	header.blockSize = DEFAULT_BLOCK_SIZE;
+
+	vector<uint8_t> bytes(sizeof(containerHeader) + 1024, 0);
+	Decoder decoder;
+	Mat_<Vec3b> out;
+
+	header.width = 60000;
+	header.height = 60000;
+	memcpy(bytes.data(), &header, sizeof(containerHeader));
+	check(readContainerHeader(bytes.data(), bytes.size(), &header) == 0, "container above MAX_CONTAINER_PIXELS is refused");
+	check(!decoder.decodeContainer(bytes.data(), bytes.size(), out) && out.empty(), "decoder refuses a container above MAX_CONTAINER_PIXELS");
+
+	header.width = 0;
+	header.height = 8;
+	memcpy(bytes.data(), &header, sizeof(containerHeader));
+	check(readContainerHeader(bytes.data(), bytes.size(), &header) == 0, "container without pixels is refused");
+
+	// 1024 bytes cannot hold the EOBs of 64x64 blocks
+	header.width = 512;
+	header.height = 512;
+	memcpy(bytes.data(), &header, sizeof(containerHeader));
+	check(readContainerHeader(bytes.data(), bytes.size(), &header) == 0, "container too short for its blocks is refused");
+
+	header.width = 8;
+	header.height = 8;
+	header.blockSize = 12;
+	memcpy(bytes.data(), &header, sizeof(containerHeader));
+	check(readContainerHeader(bytes.data(), bytes.size(), &header) == 0, "container with an unsupported block size is refused");
+
+	vector<uint8_t> stream = encodeReference(testImage(77, 93, 8), DEFAULT_QUALITY, false);
+	stream.resize(stream.size() / 2);
+	check(!decoder.decodeContainer(stream.data(), stream.size(), out), "truncated container is reported");
+}
+
+void testCorruptProgressiveStream() {
+	progressiveHeader header;
+	memcpy(header.magic, PROGRESSIVE_MAGIC, 4);
+	header.width = 1;
+	header.height = 1;
+	header.quality = DEFAULT_QUALITY;
+
+	scanDescriptor dc = { 0, 0, 0, 0 };
+	scanHeader scan = { dc, 0x40000000 };
+
+	vector<uint8_t> bytes(sizeof(progressiveHeader) + sizeof(scanHeader) + 4, 0);
+	memcpy(bytes.data(), &header, sizeof(progressiveHeader));
+	memcpy(bytes.data() + sizeof(progressiveHeader), &scan, sizeof(scanHeader));
+
+	int scans = -1;
+	decompressProgressiveImage(bytes.data(), (int)bytes.size(), &scans);
+	check(scans == 0, "scan longer than the stream is refused");
+
+	header.width = 60000;
+	header.height = 60000;
+	memcpy(bytes.data(), &header, sizeof(progressiveHeader));
+	check(decompressProgressiveImage(bytes.data(), (int)bytes.size(), &scans).empty(), "progressive image above MAX_CONTAINER_PIXELS is refused");
+
+	header.width = 8;
+	header.height = 8;
+	header.quality = 100;
+	memcpy(bytes.data(), &header, sizeof(progressiveHeader));
+	check(decompressProgressiveImage(bytes.data(), (int)bytes.size(), &scans).empty(), "progressive quality above maxQuality is refused");
+
+	memcpy(header.magic, "XXXX", 4);
+	header.quality = DEFAULT_QUALITY;
+	memcpy(bytes.data(), &header, sizeof(progressiveHeader));
+	check(decompressProgressiveImage(bytes.data(), (int)bytes.size(), &scans).empty(), "progressive stream without its magic is refused");
+}
+
+bool sequenceHeaderAccepted(sequenceHeader header) {
+	const char* filename = "JpegTests.seq";
+
+	writeFileBytes(filename, (const uint8_t*)&header, sizeof(sequenceHeader));
+
+	sequenceDecoder decoder = openSequenceDecoder(filename);
+	bool accepted = decoder.pf != NULL;
+
+	closeSequenceDecoder(&decoder);
+	remove(filename);
+
+	return accepted;
+}
+
+void testCorruptSequenceHeaders() {
+	sequenceHeader header;
+	memcpy(header.magic, SEQUENCE_MAGIC, 4);
+	header.width = 64;
+	header.height = 48;
+	header.quality = DEFAULT_QUALITY;
+
+	check(sequenceHeaderAccepted(header), "valid sequence header is accepted");
+
+	sequenceHeader forged = header;
+	memcpy(forged.magic, "XXXX", 4);
+	check(!sequenceHeaderAccepted(forged), "sequence without its magic is refused");
+
+	forged = header;
+	forged.width = -64;
+	check(!sequenceHeaderAccepted(forged), "sequence with a negative width is refused");
+
+	forged = header;
+	forged.width = 60000;
+	forged.height = 60000;
+	check(!sequenceHeaderAccepted(forged), "sequence above MAX_CONTAINER_PIXELS is refused");
+
+	forged = header;
+	forged.quality = 0;
+	check(!sequenceHeaderAccepted(forged), "sequence with quality 0 is refused");
+
+	forged = header;
+	forged.quality = maxQuality() + 1;
+	check(!sequenceHeaderAccepted(forged), "sequence with a quality above maxQuality is refused");
+}
+
+int main() {
+	// forks its workers, so it runs before the scheduler starts any thread
+	testShardedEncoder();
+	testScheduledBatch();
+	testContainerRoundTrip();
+	testProgressiveRoundTrip();
+	testPyramidRoundTrip();
+	testCorruptContainers();
+	testCorruptProgressiveStream();
+	testCorruptSequenceHeaders();
+
+	printf("%d checks, %d failed\n", checks, failures);
+
+	return failures > 0 ? 1 : 0;
+}
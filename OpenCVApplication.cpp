@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 #include "common.h"
+#include "JpegCodec.h"
 #include <math.h>
 #include <queue>
 #include <random>
@@ -10,824 +11,6 @@
 using namespace cv;
 using namespace std;
 
-typedef struct {
-	char val;
-	uchar count;
-}rleElement;
-
-rleElement EOB = { (char)255, (uchar)0 };
-
-// *************************************************************************************************
-//							Auxiliary Functions
-// *************************************************************************************************
-
-
-int minInt(int x, int y) {
-	if (x < y) {
-		return x;
-	}
-	else {
-		return y;
-	}
-}
-
-int maxInt(int x, int y) {
-	if (x > y) {
-		return x;
-	}
-	else {
-		return y;
-	}
-}
-
-bool isInside(Mat img, int i, int j) {
-	return (0 <= i && i < img.rows) && (0 <= j && j < img.cols);
-}
-
-int getNumberOfBlocksX(Mat img, int sizeOfBlock) {
-	int blocksX = img.cols / sizeOfBlock;
-
-	if (img.cols % sizeOfBlock) {
-		blocksX++;
-	}
-
-	return blocksX;
-}
-
-int getNumberOfBlocksY(Mat img, int sizeOfBlock) {
-	int blocksY = img.rows / sizeOfBlock;
-
-	if (img.rows % sizeOfBlock) {
-		blocksY++;
-	}
-
-	return blocksY;
-}
-
-Mat_<uchar> get8x8BlockAt(int x, int y, Mat_<uchar> img) {
-	Mat_<uchar> block(8, 8);
-
-	for (int i = 0; i < 8; i++) {
-		for (int j = 0; j < 8; j++) {
-			if (isInside(img, 8 * y + j, 8 * x + i)) {
-				block(j, i) = img(8 * y + j, 8 * x + i);
-			}
-			else {
-				block(j, i) = 0;
-			}
-		}
-	}
-
-	return block;
-}
-
-Mat_<uchar> getLuminance(Mat_<Vec3b> img) {
-	Mat_<Vec3b> y(img.rows, img.cols);
-
-	for (int i = 0; i < img.rows; i++) {
-		for (int j = 0; j < img.cols; j++) {
-			y(i, j) = img(i, j)[0];
-		}
-	}
-
-	return y;
-}
-
-Mat_<uchar> getRedChromatics(Mat_<Vec3b> img) {
-	Mat_<Vec3b> cr(img.rows, img.cols);
-
-	for (int i = 0; i < img.rows; i++) {
-		for (int j = 0; j < img.cols; j++) {
-			cr(i, j) = img(i, j)[1];
-		}
-	}
-
-	return cr;
-}
-
-Mat_<uchar> getBlueChromatics(Mat_<Vec3b> img) {
-	Mat_<Vec3b> cb(img.rows, img.cols);
-
-	for (int i = 0; i < img.rows; i++) {
-		for (int j = 0; j < img.cols; j++) {
-			cb(i, j) = img(i, j)[2];
-		}
-	}
-
-	return cb;
-}
-
-// *************************************************************************************************
-//							Compression
-// *************************************************************************************************
-
-
-Mat_<uchar> chromaticDownsampling(Mat_<uchar> component) {
-	int blocksX = getNumberOfBlocksX(component, 2);
-	int blocksY = getNumberOfBlocksY(component, 2);
-
-	Mat_<uchar> reducedComponent(blocksY, blocksX);
-
-	for (int x = 0; x < blocksX; x++) {
-		for (int y = 0; y < blocksY; y++) {
-			int sum = 0;
-			int num = 0;
-
-			if (isInside(component, 2 * y, 2 * x)) {
-				sum += component(2 * y, 2 * x);
-				num++;
-			}
-
-			if (isInside(component, 2 * y + 1, 2 * x)) {
-				sum += component(2 * y + 1, 2 * x);
-				num++;
-			}
-
-			if (isInside(component, 2 * y, 2 * x + 1)) {
-				sum += component(2 * y, 2 * x + 1);
-				num++;
-			}
-
-			if (isInside(component, 2 * y + 1, 2 * x + 1)) {
-				sum += component(2 * y + 1, 2 * x + 1);
-				num++;
-			}
-
-			uchar avg = (uchar)round((float)sum / num);
-
-			reducedComponent(y, x) = avg;
-		}
-	}
-
-	return reducedComponent;
-}
-
-Mat_<Vec3b> colorSpaceConversion(Mat_<Vec3b> img) {
-	Mat_<Vec3b> convertedImg(img.rows, img.cols);
-	Mat_<Vec3b> imgOut(img.rows, img.cols);
-
-	cvtColor(img, convertedImg, COLOR_BGR2YCrCb);
-
-	int blocksX = getNumberOfBlocksX(img, 2);
-	int blocksY = getNumberOfBlocksY(img, 2);
-
-	Mat_<uchar> y(img.rows, img.cols);
-	Mat_<uchar> cr(img.rows, img.cols);
-	Mat_<uchar> cb(img.rows, img.cols);
-
-	for (int i = 0; i < img.rows; i++) {
-		for (int j = 0; j < img.cols; j++) {
-			y(i, j) = convertedImg(i, j)[0];
-			cr(i, j) = convertedImg(i, j)[1];
-			cb(i, j) = convertedImg(i, j)[2];
-		}
-	}
-
-	Mat_<uchar> smallCr(blocksY, blocksX);
-	Mat_<uchar> smallCb(blocksY, blocksX);
-
-	smallCr = chromaticDownsampling(cr);
-	smallCb = chromaticDownsampling(cb);
-
-	for (int i = 0; i < img.rows; i++) {
-		for (int j = 0; j < img.cols; j++) {
-			imgOut(i, j)[0] = convertedImg(i, j)[0];
-		}
-	}
-
-	for (int x = 0; x < blocksX; x++) {
-		for (int y = 0; y < blocksY; y++) {
-			if (isInside(imgOut, 2 * y, 2 * x)) {
-				imgOut(2 * y, 2 * x)[1] = smallCr(y, x);
-				imgOut(2 * y, 2 * x)[2] = smallCb(y, x);
-			}
-
-			if (isInside(imgOut, 2 * y + 1, 2 * x)) {
-				imgOut(2 * y + 1, 2 * x)[1] = smallCr(y, x);
-				imgOut(2 * y + 1, 2 * x)[2] = smallCb(y, x);
-			}
-
-			if (isInside(imgOut, 2 * y, 2 * x + 1)) {
-				imgOut(2 * y, 2 * x + 1)[1] = smallCr(y, x);
-				imgOut(2 * y, 2 * x + 1)[2] = smallCb(y, x);
-			}
-
-			if (isInside(imgOut, 2 * y + 1, 2 * x + 1)) {
-				imgOut(2 * y + 1, 2 * x + 1)[1] = smallCr(y, x);
-				imgOut(2 * y + 1, 2 * x + 1)[2] = smallCb(y, x);
-			}
-		}
-	}
-
-	return imgOut;
-}
-
-Mat_<float> convertToSigned(Mat_<uchar> block) {
-	Mat_<float> newBlock(block.rows, block.cols);
-
-	block.convertTo(newBlock, CV_32FC1);
-
-	newBlock = newBlock - 128.0f;
-
-	return newBlock;
-}
-
-float ci(int i, int n) {
-	if (i == 0) {
-		return sqrt(1.0f / n);
-	}
-	else {
-		return sqrt(2.0f / n);
-	}
-}
-
-Mat_<float> discreteCosineTransform(Mat_<float> block) {
-	Mat_<float> transformedBlock(block.rows, block.cols, 0.0f);
-
-	for (int i = 0; i < block.rows; i++) {
-		for (int j = 0; j < block.cols; j++) {
-
-			float sX = 0.0f;
-
-			for (int x = 0; x < 8; x++) {
-
-				float sY = 0.0f;
-
-				for (int y = 0; y < 8; y++) {
-					sY += block(y, x) * cos((2 * y + 1) * i * PI / 16.0f) * cos((2 * x + 1) * j * PI / 16.0f);
-				}
-
-				sX += sY;
-			}
-
-			sX *= ci(i, 8);
-			sX *= ci(j, 8);
-
-			transformedBlock(i, j) = round(sX);
-		}
-	}
-
-	return transformedBlock;
-}
-
-
-Mat_<char> quantization(Mat_<float> block) {
-	uchar values[] = {
-		16, 11, 10, 16,  24,  40,  51,  61,
-		12, 12, 14, 19,  26,  58,  60,  55,
-		14, 13, 16, 24,  40,  57,  69,  56,
-		14, 17, 22, 29,  51,  87,  80,  62,
-		18, 22, 37, 56,  68, 109, 103,  77,
-		24, 35, 55, 64,  81, 104, 113,  92,
-		49, 64, 78, 87, 103, 121, 120, 101,
-		72, 92, 95, 98, 112, 100, 103,  99
-	};
-
-	Mat_<uchar> q(8, 8, values);
-
-	Mat_<char> qBlock(8, 8);
-
-	for (int i = 0; i < 8; i++) {
-		for (int j = 0; j < 8; j++) {
-			int value = (int)round(block(i, j) / q(i, j));
-			qBlock(i, j) = (char)value;
-		}
-	}
-
-	return qBlock;
-
-}
-
-char* zigZagTraversal(Mat_<char> mat) {
-	char* result = (char*)calloc(mat.rows * mat.cols, sizeof(char));
-	int count = 0;
-
-	int row = 0;
-	int col = 0;
-
-	bool nextRow = false;
-
-	for (int rowLimit = 1; rowLimit <= minInt(mat.rows, mat.cols); rowLimit++) {
-		for (int i = 0; i < rowLimit; i++) {
-			result[count] = mat(row, col);
-			count++;
-
-			if (i == rowLimit - 1) {
-				break;
-			}
-
-			if (nextRow) {
-				row++;
-				col--;
-			}
-			else {
-				row--;
-				col++;
-			}
-		}
-
-		if (rowLimit == minInt(mat.rows, mat.cols)) {
-			break;
-		}
-
-		if (nextRow) {
-			row++;
-			nextRow = false;
-		}
-		else {
-			col++;
-			nextRow = true;
-		}
-	}
-
-	if (row == 0) {
-		if (col == mat.cols - 1) {
-			row++;
-		}
-		else {
-			col++;
-		}
-
-		nextRow = true;
-	}
-	else {
-		if (row == mat.rows - 1) {
-			col++;
-		}
-		else {
-			row++;
-		}
-
-		nextRow = false;
-	}
-
-	for (int leftLimit = maxInt(mat.rows - 1, mat.cols - 1); leftLimit > 0; leftLimit--) {
-		int rightLimit = minInt(leftLimit, minInt(mat.rows, mat.cols));
-
-		for (int i = 0; i < rightLimit; i++) {
-			result[count] = mat(row, col);
-			count++;
-
-			if (i == rightLimit - 1) {
-				break;
-			}
-
-			if (nextRow) {
-				row++;
-				col--;
-			}
-			else {
-				row--;
-				col++;
-			}
-		}
-
-		if (row == 0) {
-			col++;
-			nextRow = true;
-		}
-		else if (col == mat.cols - 1) {
-			row++;
-			nextRow = true;
-		}
-		else if (col == 0) {
-			row++;
-			nextRow = false;
-		}
-		else if (row == mat.rows - 1) {
-			col++;
-			nextRow = false;
-		}
-	}
-
-	return result;
-}
-
-rleElement* rle(char* vals, int len, int* newLen) {
-	rleElement* encoded = (rleElement*)calloc(len + 1, sizeof(rleElement));
-	int n = 0;
-	int i = 0;
-	while (i < len) {
-		int count = 1;
-
-		while (i < len - 1 && vals[i] == vals[i + 1]) {
-			count++;
-			i++;
-		}
-
-		encoded[n].val = vals[i];
-		encoded[n].count = count;
-		n++;
-
-		i++;
-	}
-
-	encoded[n] = EOB;
-	n++;
-
-	*newLen = n;
-
-	return encoded;
-}
-
-void writeBlock(rleElement* vals, char* filename) {
-	FILE* pf = fopen(filename, "ab");
-
-	if (pf == NULL) {
-		puts("Error opening the file...");
-		return;
-	}
-
-	int i = 0;
-
-	while (true) {
-		fwrite(&vals[i], sizeof(rleElement), 1, pf);
-
-		if (vals[i].val == EOB.val && vals[i].count == EOB.count) {
-			break;
-		}
-
-		i++;
-	}
-
-	fclose(pf);
-
-}
-
-rleElement* readBlock(FILE* pf) {
-	rleElement* rleArray = (rleElement*)calloc(65, sizeof(rleElement));
-	int count = 0;
-
-	rleElement e;
-
-	while (true) {
-		fread(&e, sizeof(rleElement), 1, pf);
-
-		rleArray[count] = e;
-		count++;
-
-		if (e.val == EOB.val && e.count == EOB.count) {
-			break;
-		}
-	}
-
-	return rleArray;
-}
-
-void compressBlock(Mat_<uchar> block, char* compressedFileName) {
-	Mat_<float> signedBlock = convertToSigned(block);
-
-	Mat_<float> transformedBlock = discreteCosineTransform(signedBlock);
-
-	Mat_<char> quantizedBlock = quantization(transformedBlock);
-
-	char* vals = (char*)calloc(quantizedBlock.rows * quantizedBlock.cols, sizeof(char));
-
-	vals = zigZagTraversal(quantizedBlock);
-
-	int len = 0;
-	rleElement* rleEl = rle(vals, 64, &len);
-
-	writeBlock(rleEl, compressedFileName);
-}
-
-void compressImage(Mat_<Vec3b> img, char* filename) {
-	Mat_<Vec3b> cvt(img.rows, img.cols);
-
-	cvtColor(img, cvt, COLOR_BGR2YCrCb);
-
-	FILE* pf = fopen(filename, "wb");
-	fclose(pf);
-
-	Mat_<uchar> lum(img.rows, img.cols);
-	Mat_<uchar> cr(img.rows, img.cols);
-	Mat_<uchar> cb(img.rows, img.cols);
-
-	lum = getLuminance(cvt);
-	cr = getRedChromatics(cvt);
-	cb = getBlueChromatics(cvt);
-
-	for (int x = 0; x < getNumberOfBlocksX(img, 8); x++) {
-		for (int y = 0; y < getNumberOfBlocksY(img, 8); y++) {
-			Mat_<uchar> yBlock = get8x8BlockAt(x, y, lum);
-			Mat_<uchar> crBlock = get8x8BlockAt(x, y, cr);
-			Mat_<uchar> cbBlock = get8x8BlockAt(x, y, cb);
-
-			compressBlock(yBlock, filename);
-			compressBlock(crBlock, filename);
-			compressBlock(cbBlock, filename);
-		}
-	}
-}
-
-// *************************************************************************************************
-//							Decompression
-// *************************************************************************************************
-
-
-char* rleDecode(rleElement* e) {
-	char* decoded = (char*)calloc(64, sizeof(char));
-	int n = 0;
-
-	int i = 0;
-
-	while (true) {
-		if (e[i].count == EOB.count && e[i].val == EOB.val) {
-			break;
-		}
-
-		int cnt = e[i].count;
-		while (cnt > 0) {
-			decoded[n] = e[i].val;
-			n++;
-			cnt--;
-		}
-
-		i++;
-
-	}
-
-	while (n < 64) {
-		decoded[n] = 0;
-		n++;
-	}
-	return decoded;
-}
-
-Mat_<char> zigZagReconstruction(char* vals) {
-	Mat_<char> mat(8, 8);
-
-	int count = 0;
-
-	int row = 0;
-	int col = 0;
-
-	bool nextRow = false;
-
-	for (int rowLimit = 1; rowLimit <= minInt(mat.rows, mat.cols); rowLimit++) {
-		for (int i = 0; i < rowLimit; i++) {
-			mat(row, col) = vals[count];
-			count++;
-
-			if (i == rowLimit - 1) {
-				break;
-			}
-
-			if (nextRow) {
-				row++;
-				col--;
-			}
-			else {
-				row--;
-				col++;
-			}
-		}
-
-		if (rowLimit == minInt(mat.rows, mat.cols)) {
-			break;
-		}
-
-		if (nextRow) {
-			row++;
-			nextRow = false;
-		}
-		else {
-			col++;
-			nextRow = true;
-		}
-	}
-
-	if (row == 0) {
-		if (col == mat.cols - 1) {
-			row++;
-		}
-		else {
-			col++;
-		}
-
-		nextRow = true;
-	}
-	else {
-		if (row == mat.rows - 1) {
-			col++;
-		}
-		else {
-			row++;
-		}
-
-		nextRow = false;
-	}
-
-	for (int leftLimit = maxInt(mat.rows, mat.cols) - 1; leftLimit > 0; leftLimit--) {
-		int rightLimit = minInt(leftLimit, minInt(mat.rows, mat.cols));
-
-		for (int i = 0; i < rightLimit; i++) {
-			mat(row, col) = vals[count];
-			count++;
-
-			if (i == rightLimit - 1) {
-				break;
-			}
-
-			if (nextRow) {
-				row++;
-				col--;
-			}
-			else {
-				row--;
-				col++;
-			}
-		}
-
-		if (row == 0) {
-			col++;
-			nextRow = true;
-		}
-		else if (col == mat.cols - 1) {
-			row++;
-			nextRow = true;
-		}
-		else if (col == 0) {
-			row++;
-			nextRow = false;
-		}
-		else if (row == mat.rows - 1) {
-			col++;
-			nextRow = false;
-		}
-	}
-
-	return mat;
-}
-
-Mat_<float> dequantization(Mat_<char> qBlock) {
-	uchar values[] = {
-		16, 11, 10, 16,  24,  40,  51,  61,
-		12, 12, 14, 19,  26,  58,  60,  55,
-		14, 13, 16, 24,  40,  57,  69,  56,
-		14, 17, 22, 29,  51,  87,  80,  62,
-		18, 22, 37, 56,  68, 109, 103,  77,
-		24, 35, 55, 64,  81, 104, 113,  92,
-		49, 64, 78, 87, 103, 121, 120, 101,
-		72, 92, 95, 98, 112, 100, 103,  99
-	};
-
-	Mat_<uchar> q(8, 8, values);
-
-	Mat_<float> block(8, 8);
-
-	for (int i = 0; i < 8; i++) {
-		for (int j = 0; j < 8; j++) {
-			block(i, j) = qBlock(i, j) * q(i, j);
-		}
-	}
-
-	return block;
-}
-
-Mat_<float> inverseDiscreteCosineTransform(Mat_<float> tBlock) {
-	Mat_<float> block(tBlock.rows, tBlock.cols, 0.0f);
-
-	for (int x = 0; x < tBlock.rows; x++) {
-		for (int y = 0; y < tBlock.cols; y++) {
-
-			float sI = 0.0f;
-
-			for (int i = 0; i < 8; i++) {
-
-				float sJ = 0.0f;
-
-				for (int j = 0; j < 8; j++) {
-					sJ += ci(i, 8) * ci(j, 8) * tBlock(j, i) * cos((2 * y + 1) * i * PI / 16.0f) * cos((2 * x + 1) * j * PI / 16.0f);
-				}
-
-				sI += sJ;
-			}
-
-
-			block(x, y) = round(sI);
-		}
-	}
-
-	return block;
-}
-
-Mat_<uchar> convertToUnsigned(Mat_<float> block) {
-	Mat_<float> newBlock(block.rows, block.cols);
-
-	for (int i = 0; i < block.rows; i++) {
-		for (int j = 0; j < block.cols; j++) {
-			newBlock(i, j) = (uchar)(block(i, j) + 128.0f);
-		}
-	}
-
-	return newBlock;
-}
-
-Mat_<uchar> decompressBLock(rleElement* code) {
-	Mat_<uchar> decompressed(8, 8);
-
-	int len = 0;
-
-	char* decoded = rleDecode(code);
-
-	Mat_<char> zigZagDecodedBlock = zigZagReconstruction(decoded);
-
-	Mat_<float> dequantizedBlock = dequantization(zigZagDecodedBlock);
-
-	Mat_<float> idctBlock = inverseDiscreteCosineTransform(dequantizedBlock);
-
-	decompressed = convertToUnsigned(idctBlock);
-
-	return decompressed;
-}
-
-Mat_<Vec3b> decompressImage(char* filename, int sizeX, int sizeY) {
-	Mat_<Vec3b> decompressed(8 * sizeY, 8 * sizeX);
-
-	FILE* pf = fopen(filename, "rb");
-
-	if (!pf) {
-		puts("Error opening the file...");
-		return decompressed;
-	}
-
-	rleElement* rleY = (rleElement*)calloc(64, sizeof(rleElement));
-	rleElement* rleCr = (rleElement*)calloc(64, sizeof(rleElement));
-	rleElement* rleCb = (rleElement*)calloc(64, sizeof(rleElement));
-
-	int countY = 0;
-	int countCr = 0;
-	int countCb = 0;
-
-	for (int x = 0; x < sizeX; x++) {
-		for (int y = 0; y < sizeY; y++) {
-			countY = 0;
-			countCr = 0;
-			countCb = 0;
-
-			rleElement yCode;
-
-			while (true) {
-				fread(&yCode, sizeof(rleElement), 1, pf);
-
-				rleY[countY] = yCode;
-				countY++;
-
-				if (yCode.val == EOB.val && yCode.count == EOB.count) {
-					break;
-				}
-			}
-
-			rleElement crCode;
-
-			while (true) {
-				fread(&crCode, sizeof(rleElement), 1, pf);
-
-				rleCr[countCr] = crCode;
-				countCr++;
-
-				if (crCode.val == EOB.val && crCode.count == EOB.count) {
-					break;
-				}
-			}
-
-			rleElement cbCode;
-
-			while (true) {
-				fread(&cbCode, sizeof(rleElement), 1, pf);
-
-				rleCb[countCb] = cbCode;
-				countCb++;
-
-				if (cbCode.val == EOB.val && cbCode.count == EOB.count) {
-					break;
-				}
-			}
-
-			Mat_<uchar> decYBlock = decompressBLock(rleY);
-			Mat_<uchar> decCrBlock = decompressBLock(rleCr);
-			Mat_<uchar> decCbBlock = decompressBLock(rleCb);
-
-			for (int i = 0; i < 8; i++) {
-				for (int j = 0; j < 8; j++) {
-					decompressed(8 * y + j, 8 * x + i)[0] = decYBlock(j, i);
-					decompressed(8 * y + j, 8 * x + i)[1] = decCrBlock(j, i);
-					decompressed(8 * y + j, 8 * x + i)[2] = decCbBlock(j, i);
-				}
-			}
-		}
-	}
-
-	Mat_<Vec3b> result(8 * sizeY, 8 * sizeX);
-
-	cvtColor(decompressed, result, COLOR_YCrCb2BGR);
-
-	fclose(pf);
-
-	return result;
-}
-
 // *************************************************************************************************
 //							Test functions
 // *************************************************************************************************
@@ -1016,6 +199,183 @@ void compressAndDecompressImageTest(Mat_<Vec3b> img) {
 	waitKey(0);
 }
 
+void progressiveCompressionTest(Mat_<Vec3b> img) {
+	compressProgressiveImage(img, "progressive.bin");
+
+	FILE* pf = fopen("progressive.bin", "rb");
+	fseek(pf, 0, SEEK_END);
+	int total = (int)ftell(pf);
+	fseek(pf, 0, SEEK_SET);
+
+	imshow("original img", img);
+
+	int offset = sizeof(progressiveHeader);
+	scanHeader header;
+
+	fseek(pf, offset, SEEK_SET);
+
+	for (int s = 1; fread(&header, sizeof(scanHeader), 1, pf) == 1; s++) {
+		offset += sizeof(scanHeader) + header.length * sizeof(rleElement);
+		fseek(pf, offset, SEEK_SET);
+
+		printf("Scan %d (coefficients %d-%d, shift %d): %d of %d bytes (%.1f%%)\n",
+			s, header.scan.start, header.scan.end, header.scan.shift, offset, total, 100.0f * offset / total);
+
+		char title[64];
+		sprintf(title, "after scan %d", s);
+		imshow(title, decompressProgressiveImage("progressive.bin", offset));
+	}
+
+	fclose(pf);
+
+	waitKey(0);
+}
+
+void rateControlTest(Mat_<Vec3b> img) {
+	int maxBytes = 0;
+
+	printf("Maximum compressed size (bytes): ");
+	scanf("%d", &maxBytes);
+
+	int quality = compressImageToSize(img, "rateControlled.bin", maxBytes);
+
+	FILE* pf = fopen("rateControlled.bin", "rb");
+	fseek(pf, 0, SEEK_END);
+	printf("Quality %d, %ld bytes\n", quality, ftell(pf));
+	fclose(pf);
+
+	Mat_<Vec3b> decompressed = decompressImage("rateControlled.bin", getNumberOfBlocksX(img, 8), getNumberOfBlocksY(img, 8), quality);
+
+	imshow("original img", img);
+	imshow("decompressed img", decompressed);
+	waitKey(0);
+}
+
+void transcodeTest(Mat_<Vec3b> img) {
+	int newQuality = 0;
+
+	printf("New quality (1-100): ");
+	scanf("%d", &newQuality);
+
+	int sizeX = getNumberOfBlocksX(img, 8);
+	int sizeY = getNumberOfBlocksY(img, 8);
+
+	compressImage(img, "compressed.bin");
+	if (!transcodeImage("compressed.bin", "transcoded.bin", sizeX, sizeY, DEFAULT_QUALITY, newQuality)) {
+		return;
+	}
+
+	imshow("original img", img);
+	imshow("decompressed img", decompressImage("compressed.bin", sizeX, sizeY));
+	imshow("transcoded img", decompressImage("transcoded.bin", sizeX, sizeY, newQuality));
+	waitKey(0);
+}
+
+void losslessTransformTest(Mat_<Vec3b> img) {
+	int orientation = 0;
+
+	printf("EXIF orientation (1-8): ");
+	scanf("%d", &orientation);
+
+	int sizeX = getNumberOfBlocksX(img, 8);
+	int sizeY = getNumberOfBlocksY(img, 8);
+
+	compressImage(img, "compressed.bin");
+
+	blockTransform transform = exifOrientationTransform(orientation);
+	transformCompressedImage("compressed.bin", "transformed.bin", sizeX, sizeY, transform);
+
+	bool swapped = transform == TRANSPOSE || transform == TRANSVERSE || transform == ROTATE_90 || transform == ROTATE_270;
+
+	cropCompressedImage("compressed.bin", "cropped.bin", sizeX, sizeY, sizeX / 4, sizeY / 4, sizeX / 2, sizeY / 2);
+
+	imshow("original img", img);
+	imshow("transformed img", decompressImage("transformed.bin", swapped ? sizeY : sizeX, swapped ? sizeX : sizeY));
+	imshow("cropped img", decompressImage("cropped.bin", sizeX / 2, sizeY / 2));
+	waitKey(0);
+}
+
+void frameSequenceTest(Mat_<Vec3b> img) {
+	int frames = 30;
+
+	sequenceEncoder encoder = openSequenceEncoder("sequence.bin", img.cols, img.rows);
+
+	for (int f = 0; f < frames; f++) {
+		// a small square moving over a still background
+		Mat_<Vec3b> frame = img.clone();
+
+		for (int i = 0; i < 32; i++) {
+			for (int j = 0; j < 32; j++) {
+				if (isInside(frame, 20 + i, 4 * f + j)) {
+					frame(20 + i, 4 * f + j) = Vec3b(0, 0, 255);
+				}
+			}
+		}
+
+		long before = ftell(encoder.pf);
+		int changed = encodeFrame(&encoder, frame);
+
+		printf("Frame %d: %d of %d blocks coded, %ld bytes\n", f, changed, encoder.blocksX * encoder.blocksY, ftell(encoder.pf) - before);
+	}
+
+	closeSequenceEncoder(&encoder);
+
+	sequenceDecoder decoder = openSequenceDecoder("sequence.bin");
+	Mat_<Vec3b> frame;
+
+	while (decodeFrame(&decoder, &frame)) {
+		imshow("decompressed sequence", frame);
+		waitKey(40);
+	}
+
+	closeSequenceDecoder(&decoder);
+
+	waitKey(0);
+}
+
+void blockCacheTest(Mat_<Vec3b> img) {
+	blockCache cache = createBlockCache(1 << 20);
+
+	// the same image twice and a copy with a changed corner share most of their blocks
+	Mat_<Vec3b> edited = img.clone();
+
+	for (int i = 0; i < minInt(64, edited.rows); i++) {
+		for (int j = 0; j < minInt(64, edited.cols); j++) {
+			edited(i, j) = Vec3b(255, 255, 255);
+		}
+	}
+
+	compressImage(img, "compressed.bin", DEFAULT_QUALITY, &cache);
+	printBlockCacheStatistics(&cache);
+
+	compressImage(img, "compressed.bin", DEFAULT_QUALITY, &cache);
+	printBlockCacheStatistics(&cache);
+
+	compressImage(edited, "edited.bin", DEFAULT_QUALITY, &cache);
+	printBlockCacheStatistics(&cache);
+
+	imshow("original img", img);
+	imshow("decompressed edited img", decompressImage("edited.bin", getNumberOfBlocksX(img, 8), getNumberOfBlocksY(img, 8)));
+	waitKey(0);
+}
+
+void inMemoryCodecTest(Mat_<Vec3b> img) {
+	Encoder encoder;
+	Decoder decoder;
+
+	vector<uint8_t> stream;
+	encoder.encode(img, stream);
+
+	printf("%d x %d image, %zu bytes in memory\n", img.cols, img.rows, stream.size());
+
+	Mat_<Vec3b> decompressed;
+	decoder.decode(stream.data(), stream.size(), getNumberOfBlocksX(img, 8), getNumberOfBlocksY(img, 8), decompressed);
+
+	imshow("original img", img);
+	imshow("decompressed img", decompressed);
+	waitKey(0);
+}
+
 int main()
 {
 	int op;
@@ -1030,6 +390,13 @@ int main()
 		printf("5. Zig zag traversal (example)\n");
 		printf("6. Inverse discrete cosine transform (example)\n");
 		printf("7. Compress and decompress an image\n");
+		printf("8. Progressive compression of an image\n");
+		printf("9. Compress an image to a target size\n");
+		printf("10. Transcode a compressed image to another quality\n");
+		printf("11. Lossless rotation and crop of a compressed image\n");
+		printf("12. Compress a frame sequence\n");
+		printf("13. Compress images with a shared block cache\n");
+		printf("14. Compress and decompress an image in memory\n");
 		printf("Option: ");
 		scanf("%d", &op);
 		switch (op)
@@ -1057,6 +424,41 @@ int main()
 				compressAndDecompressImageTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
 				break;
 			}
+			case 8:
+			{
+				progressiveCompressionTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 9:
+			{
+				rateControlTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 10:
+			{
+				transcodeTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 11:
+			{
+				losslessTransformTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 12:
+			{
+				frameSequenceTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 13:
+			{
+				blockCacheTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
+			case 14:
+			{
+				inMemoryCodecTest(imread("Images/Set/mexico.bmp", IMREAD_COLOR));
+				break;
+			}
 
 
 		}
@@ -0,0 +1,235 @@
+// ShardedEncoder.cpp : Coordinator and worker processes of the sharded encoder.
+//
+
+#include "stdafx.h"
+#include "ShardedEncoder.h"
+#include <chrono>
+
+using namespace cv;
+using namespace std;
+
+shardOptions defaultShardOptions() {
+	shardOptions options;
+
+	options.workers = 4;
+	options.pinWorkers = false;
+
+	return options;
+}
+
+#ifdef _WIN32
+
+bool encodeSharded(const Mat_<Vec3b>& img, int quality, bool subsampling, shardOptions* options, vector<uint8_t>& out, vector<shardResult>* results) {
+	puts("Sharded encoding needs fork and POSIX shared memory, which this platform does not have");
+	return false;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Filled in by a worker in the control segment; the coordinator only trusts it once the worker exited cleanly
+typedef struct {
+	uint64_t bytes;
+	double seconds;
+	int32_t done;
+}shardControl;
+
+// Maps a new shared memory object and unlinks its name right away: forked workers inherit the mapping,
+// and nothing is left behind in /dev/shm whichever process dies first
+uint8_t* createSharedSegment(const char* role, size_t size) {
+	static int sequence = 0;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/jpegshard-%d-%s-%d", (int)getpid(), role, sequence++);
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	shm_unlink(name);
+
+	void* mapped = MAP_FAILED;
+
+	if (ftruncate(fd, size) == 0) {
+		mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	return mapped == MAP_FAILED ? NULL : (uint8_t*)mapped;
+}
+
+void pinToProcessor(int worker) {
+#ifdef __linux__
+	int processors = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (processors > 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker % processors, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+#endif
+}
+
+// Runs in the worker process: codes the block columns of its range into its own output segment
+void runShardWorker(Mat_<uchar>* planes, int firstColumn, int lastColumn, int quality, uint8_t* segment, size_t capacity, shardControl* control) {
+	auto start = chrono::steady_clock::now();
+
+	vector<uint8_t> code;
+
+	for (int x = firstColumn; x < lastColumn; x++) {
+		appendBlockColumn(planes, x, quality, NULL, code);
+	}
+
+	if (code.size() > capacity) {
+		return;
+	}
+
+	memcpy(segment, code.data(), code.size());
+
+	control->bytes = code.size();
+	control->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	control->done = 1;
+}
+
+bool encodeSharded(const Mat_<Vec3b>& img, int quality, bool subsampling, shardOptions* options, vector<uint8_t>& out, vector<shardResult>* results) {
+	if (img.empty()) {
+		return false;
+	}
+
+	int columns = getNumberOfBlocksX(img, 8);
+	int blocksY = getNumberOfBlocksY(img, 8);
+	int workers = minInt(maxInt(options->workers, 1), columns);
+
+	size_t planeSize = (size_t)img.rows * img.cols;
+	size_t columnCapacity = (size_t)blocksY * COMPONENTS * MAX_BLOCK_CODE * sizeof(rleElement);
+
+	// ranges of whole block columns, as even as the column count allows
+	vector<int> firstColumns(workers + 1);
+
+	for (int w = 0; w <= workers; w++) {
+		firstColumns[w] = (int)((long long)columns * w / workers);
+	}
+
+	size_t outputSize = 0;
+	vector<size_t> segmentOffsets(workers);
+
+	for (int w = 0; w < workers; w++) {
+		segmentOffsets[w] = outputSize;
+		outputSize += (firstColumns[w + 1] - firstColumns[w]) * columnCapacity;
+	}
+
+	// the output is sized for the worst case, but only the pages the workers write are ever backed
+	uint8_t* planeMemory = createSharedSegment("planes", COMPONENTS * planeSize);
+	uint8_t* outputMemory = createSharedSegment("output", outputSize);
+	shardControl* controls = (shardControl*)createSharedSegment("control", workers * sizeof(shardControl));
+
+	bool ok = planeMemory != NULL && outputMemory != NULL && controls != NULL;
+
+	if (ok) {
+		Mat_<uchar> planes[COMPONENTS];
+		Mat_<Vec3b> converted;
+
+		for (int c = 0; c < COMPONENTS; c++) {
+			planes[c] = Mat_<uchar>(img.rows, img.cols, planeMemory + c * planeSize);
+		}
+
+		// the planes already have the size of img, so they are filled in place in shared memory
+		splitComponents(img, converted, planes, subsampling);
+
+		fflush(stdout);
+
+		vector<pid_t> children(workers, -1);
+
+		for (int w = 0; w < workers; w++) {
+			pid_t pid = fork();
+
+			if (pid == 0) {
+				if (options->pinWorkers) {
+					pinToProcessor(w);
+				}
+
+				runShardWorker(planes, firstColumns[w], firstColumns[w + 1], quality, outputMemory + segmentOffsets[w],
+					(firstColumns[w + 1] - firstColumns[w]) * columnCapacity, &controls[w]);
+
+				// skip the destructors and atexit handlers of the coordinator's state
+				_exit(controls[w].done ? 0 : 1);
+			}
+
+			children[w] = pid;
+		}
+
+		if (results != NULL) {
+			results->clear();
+		}
+
+		for (int w = 0; w < workers; w++) {
+			int status = 0;
+
+			bool workerOk = children[w] > 0 && waitpid(children[w], &status, 0) == children[w]
+				&& WIFEXITED(status) && WEXITSTATUS(status) == 0 && controls[w].done == 1;
+
+			if (!workerOk) {
+				if (children[w] < 0) {
+					printf("Cannot start worker %d\n", w);
+				}
+				else if (WIFSIGNALED(status)) {
+					printf("Worker %d (block columns %d to %d) was killed by signal %d\n", w, firstColumns[w], firstColumns[w + 1] - 1, WTERMSIG(status));
+				}
+				else {
+					printf("Worker %d (block columns %d to %d) failed\n", w, firstColumns[w], firstColumns[w + 1] - 1);
+				}
+			}
+
+			ok = ok && workerOk;
+
+			if (results != NULL) {
+				shardResult r;
+
+				r.worker = w;
+				r.firstColumn = firstColumns[w];
+				r.lastColumn = firstColumns[w + 1] - 1;
+				r.bytes = workerOk ? controls[w].bytes : 0;
+				r.seconds = workerOk ? controls[w].seconds : 0;
+				r.ok = workerOk;
+
+				results->push_back(r);
+			}
+		}
+	}
+
+	if (ok) {
+		appendContainerHeader(out, img.cols, img.rows, quality);
+
+		// the segments are contiguous pieces of the column-major stream, so stitching is concatenation
+		for (int w = 0; w < workers; w++) {
+			uint8_t* segment = outputMemory + segmentOffsets[w];
+			out.insert(out.end(), segment, segment + controls[w].bytes);
+		}
+	}
+
+	if (planeMemory != NULL) {
+		munmap(planeMemory, COMPONENTS * planeSize);
+	}
+
+	if (outputMemory != NULL) {
+		munmap(outputMemory, outputSize);
+	}
+
+	if (controls != NULL) {
+		munmap(controls, workers * sizeof(shardControl));
+	}
+
+	return ok;
+}
+
+#endif
@@ -0,0 +1,32 @@
+// ShardedEncoder.h : Encodes one image with several worker processes sharing its planes through POSIX shared memory.
+//
+
+#pragma once
+
+#include "JpegCodec.h"
+
+// the longest code of one block: every coefficient in its own run, then the EOB
+#define MAX_BLOCK_CODE (COEFFICIENTS_PER_BLOCK + 1)
+
+typedef struct {
+	int workers;
+	// binds worker i to processor i modulo the processor count (Linux only)
+	bool pinWorkers;
+}shardOptions;
+
+typedef struct {
+	int worker;
+	int firstColumn;
+	int lastColumn;
+	size_t bytes;
+	double seconds;
+	bool ok;
+}shardResult;
+
+shardOptions defaultShardOptions();
+
+// Appends the same container Encoder::encodeContainer would to out. The coordinator converts img into
+// shared planes, forks one worker per range of block columns (the stream is column-major) and stitches
+// the segments the workers coded into shared memory. A worker that crashes or fails only fails this
+// image: false is returned and out is left as it was. Forks, so call it from a single-threaded process.
+bool encodeSharded(const cv::Mat_<cv::Vec3b>& img, int quality, bool subsampling, shardOptions* options, std::vector<uint8_t>& out, std::vector<shardResult>* results = NULL);
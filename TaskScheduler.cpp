@@ -0,0 +1,250 @@
+// TaskScheduler.cpp : Work-stealing thread pool and the batch encoder built on it.
+//
+
+#include "stdafx.h"
+#include "TaskScheduler.h"
+#include <memory>
+
+using namespace cv;
+using namespace std;
+
+// index of the worker running on this thread, -1 outside the pool
+static thread_local int currentWorker = -1;
+static thread_local WorkStealingScheduler* currentScheduler = NULL;
+
+// *************************************************************************************************
+//							Scheduler
+// *************************************************************************************************
+
+WorkStealingScheduler::WorkStealingScheduler(int workers) {
+	nextWorker = 0;
+	queued = 0;
+	pending = 0;
+	stopping = false;
+	statisticsStart = chrono::steady_clock::now();
+
+	for (int i = 0; i < maxInt(workers, 1); i++) {
+		worker* w = new worker;
+		w->tasksExecuted = 0;
+		w->tasksStolen = 0;
+		w->busyNanoseconds = 0;
+
+		this->workers.push_back(w);
+	}
+
+	for (int i = 0; i < (int)this->workers.size(); i++) {
+		threads.push_back(thread(&WorkStealingScheduler::run, this, i));
+	}
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+	wait();
+
+	{
+		lock_guard<mutex> lock(sleepMutex);
+		stopping = true;
+	}
+
+	wakeUp.notify_all();
+
+	for (thread& t : threads) {
+		t.join();
+	}
+
+	for (worker* w : workers) {
+		delete w;
+	}
+}
+
+void WorkStealingScheduler::submit(function<void()> task) {
+	int id = currentScheduler == this ? currentWorker : nextWorker++ % (int)workers.size();
+
+	pending++;
+
+	{
+		lock_guard<mutex> lock(workers[id]->mutex);
+		workers[id]->tasks.push_back(task);
+	}
+
+	{
+		lock_guard<mutex> lock(sleepMutex);
+		queued++;
+	}
+
+	wakeUp.notify_one();
+}
+
+void WorkStealingScheduler::wait() {
+	unique_lock<mutex> lock(sleepMutex);
+
+	done.wait(lock, [this]() { return pending == 0; });
+}
+
+int WorkStealingScheduler::getWorkerCount() const {
+	return (int)workers.size();
+}
+
+vector<workerStatistics> WorkStealingScheduler::getStatistics() {
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - statisticsStart).count();
+
+	vector<workerStatistics> statistics;
+
+	for (worker* w : workers) {
+		workerStatistics s;
+
+		s.tasksExecuted = w->tasksExecuted;
+		s.tasksStolen = w->tasksStolen;
+		s.busySeconds = w->busyNanoseconds / 1e9;
+		s.utilization = elapsed > 0 ? s.busySeconds / elapsed : 0;
+
+		statistics.push_back(s);
+	}
+
+	return statistics;
+}
+
+void WorkStealingScheduler::resetStatistics() {
+	for (worker* w : workers) {
+		w->tasksExecuted = 0;
+		w->tasksStolen = 0;
+		w->busyNanoseconds = 0;
+	}
+
+	statisticsStart = chrono::steady_clock::now();
+}
+
+bool WorkStealingScheduler::popLocal(int id, function<void()>& task) {
+	lock_guard<mutex> lock(workers[id]->mutex);
+
+	if (workers[id]->tasks.empty()) {
+		return false;
+	}
+
+	task = workers[id]->tasks.back();
+	workers[id]->tasks.pop_back();
+
+	return true;
+}
+
+bool WorkStealingScheduler::steal(int id, function<void()>& task) {
+	int n = (int)workers.size();
+
+	for (int i = 1; i < n; i++) {
+		worker* victim = workers[(id + i) % n];
+
+		lock_guard<mutex> lock(victim->mutex);
+
+		if (!victim->tasks.empty()) {
+			task = victim->tasks.front();
+			victim->tasks.pop_front();
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingScheduler::run(int id) {
+	currentWorker = id;
+	currentScheduler = this;
+
+	worker* self = workers[id];
+
+	while (true) {
+		function<void()> task;
+
+		bool local = popLocal(id, task);
+
+		if (local || steal(id, task)) {
+			queued--;
+
+			auto start = chrono::steady_clock::now();
+
+			task();
+
+			self->busyNanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+			self->tasksExecuted++;
+
+			if (!local) {
+				self->tasksStolen++;
+			}
+
+			if (--pending == 0) {
+				lock_guard<mutex> lock(sleepMutex);
+				done.notify_all();
+			}
+
+			continue;
+		}
+
+		unique_lock<mutex> lock(sleepMutex);
+
+		wakeUp.wait(lock, [this]() { return stopping || queued > 0; });
+
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+// *************************************************************************************************
+//							Batch Encoding
+// *************************************************************************************************
+
+typedef struct {
+	vector<vector<uint8_t>> columns;
+	atomic<int> remaining;
+}batchImage;
+
+void encodeBlockColumnTask(const Mat_<Vec3b>& img, int x, int quality, bool subsampling, vector<uint8_t>& out) {
+	// each task converts only its own 8 pixel wide strip; 8 is even, so the 2x2 chroma averaging stays aligned
+	Mat_<Vec3b> strip = img(Rect(8 * x, 0, minInt(8, img.cols - 8 * x), img.rows));
+	Mat_<Vec3b> converted;
+	Mat_<uchar> planes[COMPONENTS];
+
+	splitComponents(strip, converted, planes, subsampling);
+
+	appendBlockColumn(planes, 0, quality, NULL, out);
+}
+
+vector<vector<uint8_t>> encodeBatch(WorkStealingScheduler& scheduler, const vector<Mat_<Vec3b>>& images, int quality, bool subsampling) {
+	vector<vector<uint8_t>> streams(images.size());
+	vector<unique_ptr<batchImage>> batch;
+
+	for (size_t i = 0; i < images.size(); i++) {
+		batch.push_back(unique_ptr<batchImage>(new batchImage));
+		batch[i]->columns.resize(getNumberOfBlocksX(images[i], 8));
+		batch[i]->remaining = (int)batch[i]->columns.size();
+	}
+
+	for (size_t i = 0; i < images.size(); i++) {
+		if (images[i].empty()) {
+			continue;
+		}
+
+		for (int x = 0; x < (int)batch[i]->columns.size(); x++) {
+			scheduler.submit([&, i, x]() {
+				batchImage* image = batch[i].get();
+
+				encodeBlockColumnTask(images[i], x, quality, subsampling, image->columns[x]);
+
+				// the task finishing the last column of an image assembles its stream in column order
+				if (--image->remaining == 0) {
+					vector<uint8_t>& stream = streams[i];
+
+					appendContainerHeader(stream, images[i].cols, images[i].rows, quality);
+
+					for (vector<uint8_t>& column : image->columns) {
+						stream.insert(stream.end(), column.begin(), column.end());
+						vector<uint8_t>().swap(column);
+					}
+				}
+			});
+		}
+	}
+
+	scheduler.wait();
+
+	return streams;
+}
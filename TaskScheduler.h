@@ -0,0 +1,66 @@
+// TaskScheduler.h : Work-stealing thread pool and the batch encoder that splits images into block-column tasks.
+//
+
+#pragma once
+
+#include "JpegCodec.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+typedef struct {
+	long long tasksExecuted;
+	long long tasksStolen;
+	double busySeconds;
+	// share of the time since the statistics were reset that the worker spent running tasks
+	double utilization;
+}workerStatistics;
+
+// Every worker owns a deque: it takes its own tasks from the back and, once it runs dry, steals the
+// oldest tasks from the front of the other deques. Tasks submitted by a task stay on its worker.
+class WorkStealingScheduler {
+public:
+	WorkStealingScheduler(int workers);
+	~WorkStealingScheduler();
+
+	void submit(std::function<void()> task);
+
+	// Returns once every submitted task, including the ones they submitted, has finished
+	void wait();
+
+	int getWorkerCount() const;
+	std::vector<workerStatistics> getStatistics();
+	void resetStatistics();
+
+private:
+	typedef struct {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+		std::atomic<long long> tasksExecuted;
+		std::atomic<long long> tasksStolen;
+		std::atomic<long long> busyNanoseconds;
+	}worker;
+
+	bool popLocal(int id, std::function<void()>& task);
+	bool steal(int id, std::function<void()>& task);
+	void run(int id);
+
+	std::vector<worker*> workers;
+	std::vector<std::thread> threads;
+	std::atomic<int> nextWorker;
+	std::atomic<long long> queued;
+	std::atomic<long long> pending;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::condition_variable done;
+	bool stopping;
+	std::chrono::steady_clock::time_point statisticsStart;
+};
+
+// Encodes every image of the batch into a container (as Encoder::encodeContainer would) with one task per
+// block column, so a few large images and many small ones keep all the workers equally busy
+std::vector<std::vector<uint8_t>> encodeBatch(WorkStealingScheduler& scheduler, const std::vector<cv::Mat_<cv::Vec3b>>& images, int quality = DEFAULT_QUALITY, bool subsampling = false);
@@ -0,0 +1,331 @@
+// TilePyramid.cpp : Streaming writer and random-access reader of tile pyramid archives.
+//
+
+#include "stdafx.h"
+#include "TilePyramid.h"
+#include <limits.h>
+
+using namespace cv;
+using namespace std;
+
+pyramidOptions defaultPyramidOptions() {
+	pyramidOptions options;
+
+	options.quality = DEFAULT_QUALITY;
+	options.blockSize = DEFAULT_BLOCK_SIZE;
+	options.tileSize = DEFAULT_TILE_SIZE;
+	options.subsampling = false;
+	options.maxLevels = 0;
+
+	return options;
+}
+
+vector<pyramidLevel> pyramidLevels(int width, int height, int tileSize, int maxLevels) {
+	vector<pyramidLevel> levels;
+	int firstTile = 0;
+
+	while (true) {
+		pyramidLevel level;
+
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + tileSize - 1) / tileSize;
+		level.tilesY = (height + tileSize - 1) / tileSize;
+		level.firstTile = firstTile;
+
+		levels.push_back(level);
+		firstTile += level.tilesX * level.tilesY;
+
+		if ((width <= tileSize && height <= tileSize) || (int)levels.size() == maxLevels) {
+			break;
+		}
+
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+
+	return levels;
+}
+
+// *************************************************************************************************
+//							Writer
+// *************************************************************************************************
+
+pyramidWriter openPyramidWriter(const char* filename, int width, int height, pyramidOptions* options) {
+	pyramidWriter writer;
+
+	writer.pf = NULL;
+	writer.ok = false;
+
+	// a pair of rows always sits in one strip, as long as a strip holds two of them
+	if (width <= 0 || height <= 0 || options->tileSize < 2 || !isSupportedBlockSize(options->blockSize)) {
+		puts("Invalid pyramid parameters...");
+		return writer;
+	}
+
+	memcpy(writer.header.magic, PYRAMID_MAGIC, sizeof(writer.header.magic));
+	writer.header.width = width;
+	writer.header.height = height;
+	writer.header.quality = effectiveQuality(options->quality, options->blockSize);
+	writer.header.blockSize = options->blockSize;
+	writer.header.tileSize = options->tileSize;
+
+	writer.levels = pyramidLevels(width, height, options->tileSize, options->maxLevels);
+	writer.header.levels = (int)writer.levels.size();
+
+	pyramidLevel& last = writer.levels.back();
+	writer.tiles.assign(last.firstTile + last.tilesX * last.tilesY, { 0, 0 });
+
+	for (pyramidLevel& level : writer.levels) {
+		writer.strips.push_back(Mat_<Vec3b>(minInt(options->tileSize, level.height), level.width));
+		writer.rowsReceived.push_back(0);
+	}
+
+	writer.encoder.setQuality(options->quality);
+	writer.encoder.setSubsampling(options->subsampling);
+	writer.encoder.setBlockSize(options->blockSize);
+
+	writer.pf = fopen(filename, "wb");
+
+	if (writer.pf == NULL) {
+		puts("Error opening the file...");
+		return writer;
+	}
+
+	// the index is reserved here and written again once the offsets of the tiles are known
+	writer.ok = fwrite(&writer.header, sizeof(pyramidHeader), 1, writer.pf) == 1
+		&& fwrite(writer.levels.data(), sizeof(pyramidLevel), writer.levels.size(), writer.pf) == writer.levels.size()
+		&& fwrite(writer.tiles.data(), sizeof(tileEntry), writer.tiles.size(), writer.pf) == writer.tiles.size();
+
+	writer.offset = sizeof(pyramidHeader) + writer.levels.size() * sizeof(pyramidLevel) + writer.tiles.size() * sizeof(tileEntry);
+
+	return writer;
+}
+
+void writeTileRow(pyramidWriter* writer, int l, int tileRow, int rows) {
+	pyramidLevel& level = writer->levels[l];
+	int tileSize = writer->header.tileSize;
+
+	for (int tx = 0; tx < level.tilesX; tx++) {
+		int tileWidth = minInt(tileSize, level.width - tx * tileSize);
+		Mat_<Vec3b> tile = writer->strips[l](Rect(tx * tileSize, 0, tileWidth, rows));
+
+		writer->scratch.clear();
+		writer->encoder.encodeContainer(tile, writer->scratch);
+
+		tileEntry& entry = writer->tiles[level.firstTile + tileRow * level.tilesX + tx];
+		entry.offset = writer->offset;
+		entry.length = writer->scratch.size();
+
+		if (fwrite(writer->scratch.data(), 1, writer->scratch.size(), writer->pf) != writer->scratch.size()) {
+			writer->ok = false;
+		}
+
+		writer->offset += writer->scratch.size();
+	}
+}
+
+// Called once the next row of level l is in its strip: codes the row of tiles it completes, and every
+// second row averages 2x2 pixels of the last two into the next level, which goes through the same steps
+void levelRowAdded(pyramidWriter* writer, int l) {
+	pyramidLevel& level = writer->levels[l];
+	int tileSize = writer->header.tileSize;
+	int row = writer->rowsReceived[l]++;
+	bool lastRow = row == level.height - 1;
+
+	if (row % tileSize == tileSize - 1 || lastRow) {
+		writeTileRow(writer, l, row / tileSize, row % tileSize + 1);
+	}
+
+	if (l + 1 == (int)writer->levels.size() || (row % 2 == 0 && !lastRow)) {
+		return;
+	}
+
+	// an odd last row is paired with itself, and so is an odd last column
+	const Vec3b* below = &writer->strips[l](row % tileSize, 0);
+	const Vec3b* above = row % 2 == 0 ? below : &writer->strips[l]((row - 1) % tileSize, 0);
+	Vec3b* reduced = &writer->strips[l + 1](writer->rowsReceived[l + 1] % tileSize, 0);
+
+	for (int j = 0; j < writer->levels[l + 1].width; j++) {
+		int left = 2 * j;
+		int right = minInt(2 * j + 1, level.width - 1);
+
+		for (int c = 0; c < 3; c++) {
+			reduced[j][c] = (uchar)((above[left][c] + above[right][c] + below[left][c] + below[right][c] + 2) / 4);
+		}
+	}
+
+	levelRowAdded(writer, l + 1);
+}
+
+bool addPyramidRows(pyramidWriter* writer, const Mat_<Vec3b>& rows) {
+	if (writer->pf == NULL || rows.cols != writer->header.width || writer->rowsReceived[0] + rows.rows > writer->header.height) {
+		puts("The rows do not match the pyramid...");
+		return false;
+	}
+
+	for (int i = 0; i < rows.rows; i++) {
+		Vec3b* row = &writer->strips[0](writer->rowsReceived[0] % writer->header.tileSize, 0);
+
+		memcpy(row, &rows(i, 0), rows.cols * sizeof(Vec3b));
+
+		levelRowAdded(writer, 0);
+	}
+
+	return writer->ok;
+}
+
+bool closePyramidWriter(pyramidWriter* writer) {
+	if (writer->pf == NULL) {
+		return false;
+	}
+
+	bool complete = writer->rowsReceived[0] == writer->header.height;
+
+	if (!complete) {
+		puts("The source rows of the pyramid are incomplete...");
+	}
+
+	long indexOffset = (long)(sizeof(pyramidHeader) + writer->levels.size() * sizeof(pyramidLevel));
+
+	bool ok = writer->ok && complete && fseek(writer->pf, indexOffset, SEEK_SET) == 0
+		&& fwrite(writer->tiles.data(), sizeof(tileEntry), writer->tiles.size(), writer->pf) == writer->tiles.size();
+
+	ok = fclose(writer->pf) == 0 && ok;
+	writer->pf = NULL;
+
+	return ok;
+}
+
+bool writeTilePyramid(const Mat_<Vec3b>& img, const char* filename, pyramidOptions* options) {
+	pyramidWriter writer = openPyramidWriter(filename, img.cols, img.rows, options);
+
+	bool ok = writer.pf != NULL;
+
+	for (int y = 0; ok && y < img.rows; y += options->tileSize) {
+		ok = addPyramidRows(&writer, img(Rect(0, y, img.cols, minInt(options->tileSize, img.rows - y))));
+	}
+
+	return closePyramidWriter(&writer) && ok;
+}
+
+// *************************************************************************************************
+//							Reader
+// *************************************************************************************************
+
+// The level table has to be the one the header gives, and the index has to fit in the file, before any of
+// its numbers is used to find a tile
+bool validPyramidIndex(pyramidReader* reader) {
+	pyramidHeader& header = reader->header;
+
+	// the sizes are checked first so that pyramidLevels does not overflow on them
+	if (header.width <= 0 || header.height <= 0 || header.tileSize < 2 || !isSupportedBlockSize(header.blockSize)
+		|| (long long)header.width + header.tileSize > INT_MAX || (long long)header.height + header.tileSize > INT_MAX) {
+		return false;
+	}
+
+	long long tilesX = ((long long)header.width + header.tileSize - 1) / header.tileSize;
+	long long tilesY = ((long long)header.height + header.tileSize - 1) / header.tileSize;
+
+	// the index holds at least the tiles of level 0; with at most INT_MAX / 8 of them the tiles of all the
+	// levels together still fit in the int of firstTile
+	if (tilesX * tilesY > (long long)(reader->fileSize / sizeof(tileEntry)) || tilesX * tilesY > INT_MAX / 8) {
+		return false;
+	}
+
+	vector<pyramidLevel> expected = pyramidLevels(header.width, header.height, header.tileSize, header.levels);
+
+	if (expected.size() != reader->levels.size()) {
+		return false;
+	}
+
+	for (size_t l = 0; l < expected.size(); l++) {
+		if (memcmp(&expected[l], &reader->levels[l], sizeof(pyramidLevel)) != 0) {
+			return false;
+		}
+	}
+
+	pyramidLevel& last = expected.back();
+	uint64_t tiles = (uint64_t)last.firstTile + (uint64_t)last.tilesX * last.tilesY;
+
+	return reader->indexOffset + tiles * sizeof(tileEntry) <= reader->fileSize;
+}
+
+pyramidReader openPyramidReader(const char* filename) {
+	pyramidReader reader;
+
+	reader.pf = fopen(filename, "rb");
+
+	bool ok = reader.pf != NULL && fread(&reader.header, sizeof(pyramidHeader), 1, reader.pf) == 1
+		&& memcmp(reader.header.magic, PYRAMID_MAGIC, sizeof(reader.header.magic)) == 0
+		&& reader.header.levels > 0 && reader.header.levels <= 32;
+
+	if (ok) {
+		reader.levels.resize(reader.header.levels);
+
+		ok = fread(reader.levels.data(), sizeof(pyramidLevel), reader.levels.size(), reader.pf) == reader.levels.size();
+	}
+
+	if (ok) {
+		fseek(reader.pf, 0, SEEK_END);
+
+		reader.fileSize = ftell(reader.pf);
+		reader.indexOffset = sizeof(pyramidHeader) + reader.levels.size() * sizeof(pyramidLevel);
+
+		ok = validPyramidIndex(&reader);
+	}
+
+	if (!ok) {
+		puts("Error opening the file...");
+
+		if (reader.pf != NULL) {
+			fclose(reader.pf);
+			reader.pf = NULL;
+		}
+
+		reader.levels.clear();
+	}
+
+	return reader;
+}
+
+bool readPyramidTile(pyramidReader* reader, int level, int x, int y, vector<uint8_t>& bytes) {
+	if (reader->pf == NULL || level < 0 || level >= (int)reader->levels.size()) {
+		return false;
+	}
+
+	pyramidLevel& l = reader->levels[level];
+
+	if (x < 0 || x >= l.tilesX || y < 0 || y >= l.tilesY) {
+		return false;
+	}
+
+	tileEntry entry;
+	uint64_t position = reader->indexOffset + ((uint64_t)l.firstTile + (uint64_t)y * l.tilesX + x) * sizeof(tileEntry);
+
+	if (fseek(reader->pf, (long)position, SEEK_SET) != 0 || fread(&entry, sizeof(tileEntry), 1, reader->pf) != 1) {
+		return false;
+	}
+
+	// a tile the writer never got to has no data
+	if (entry.length == 0 || entry.offset > reader->fileSize || entry.length > reader->fileSize - entry.offset) {
+		return false;
+	}
+
+	bytes.resize(entry.length);
+
+	return fseek(reader->pf, (long)entry.offset, SEEK_SET) == 0 && fread(bytes.data(), 1, bytes.size(), reader->pf) == bytes.size();
+}
+
+bool decodePyramidTile(pyramidReader* reader, int level, int x, int y, Mat_<Vec3b>& tile) {
+	vector<uint8_t> bytes;
+
+	return readPyramidTile(reader, level, x, y, bytes) && reader->decoder.decodeContainer(bytes.data(), bytes.size(), tile);
+}
+
+void closePyramidReader(pyramidReader* reader) {
+	if (reader->pf != NULL) {
+		fclose(reader->pf);
+		reader->pf = NULL;
+	}
+}
@@ -0,0 +1,92 @@
+// TilePyramid.h : Multi-resolution tile pyramid coded in one pass over the source into a single indexed archive.
+//
+
+#pragma once
+
+#include "JpegCodec.h"
+
+#define PYRAMID_MAGIC "JPP1"
+#define DEFAULT_TILE_SIZE 256
+
+// The archive holds a pyramidHeader, one pyramidLevel per level, one tileEntry per tile (level by level,
+// then row by row) and the tiles in the order they were coded. Every tile is a container of its own, so
+// any tile is read with one seek into the index and one to its data, whatever the other tiles hold.
+typedef struct {
+	char magic[4];
+	int width;
+	int height;
+	int quality;
+	int blockSize;
+	int tileSize;
+	int levels;
+}pyramidHeader;
+
+// Level 0 is the source; every next one halves it, rounding up
+typedef struct {
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+	// position of the level's first tile in the index
+	int firstTile;
+}pyramidLevel;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t length;
+}tileEntry;
+
+typedef struct {
+	int quality;
+	int blockSize;
+	int tileSize;
+	bool subsampling;
+	// 0 keeps halving until a level fits in one tile
+	int maxLevels;
+}pyramidOptions;
+
+// Holds one strip per level, a row of tiles high, that its rows are written into in turn. A row is paired
+// with the one above it while both are still in the strip, so the memory it takes grows with the width of
+// the source and not its height.
+typedef struct {
+	FILE* pf;
+	pyramidHeader header;
+	std::vector<pyramidLevel> levels;
+	std::vector<tileEntry> tiles;
+	std::vector<cv::Mat_<cv::Vec3b>> strips;
+	std::vector<int> rowsReceived;
+	uint64_t offset;
+	Encoder encoder;
+	std::vector<uint8_t> scratch;
+	bool ok;
+}pyramidWriter;
+
+typedef struct {
+	FILE* pf;
+	pyramidHeader header;
+	std::vector<pyramidLevel> levels;
+	uint64_t indexOffset;
+	uint64_t fileSize;
+	Decoder decoder;
+}pyramidReader;
+
+pyramidOptions defaultPyramidOptions();
+std::vector<pyramidLevel> pyramidLevels(int width, int height, int tileSize, int maxLevels);
+
+// Rows are given top to bottom, any number at a time. Each level is downsampled from the rows of the one
+// above as they arrive, and a row of tiles is coded and written as soon as its last row is in.
+pyramidWriter openPyramidWriter(const char* filename, int width, int height, pyramidOptions* options);
+bool addPyramidRows(pyramidWriter* writer, const cv::Mat_<cv::Vec3b>& rows);
+
+// Writes the index; returns false if writing failed or rows of the source are missing
+bool closePyramidWriter(pyramidWriter* writer);
+
+// Feeds img to a writer one row of tiles at a time
+bool writeTilePyramid(const cv::Mat_<cv::Vec3b>& img, const char* filename, pyramidOptions* options);
+
+// Reads the header and the level table only; pf is NULL if the file is not an archive, or if its level
+// table is not the one pyramidLevels gives for its header or its index does not fit in it
+pyramidReader openPyramidReader(const char* filename);
+bool readPyramidTile(pyramidReader* reader, int level, int x, int y, std::vector<uint8_t>& bytes);
+bool decodePyramidTile(pyramidReader* reader, int level, int x, int y, cv::Mat_<cv::Vec3b>& tile);
+void closePyramidReader(pyramidReader* reader);
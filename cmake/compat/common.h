@@ -0,0 +1,8 @@
+// common.h : Stand-in for the helpers header of the Visual Studio project, used by the CMake build.
+//
+
+#pragma once
+
+#include "stdafx.h"
+
+#define PI 3.14159265358979323846